@@ -0,0 +1,204 @@
+#include "PlaybackEngine.hpp"
+#include "MacroFile.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+// Plays synthetic macros through the real scheduler into an in-process sink
+// and reports how late each frame arrived. Needs neither /dev/uinput nor root.
+
+namespace {
+
+class TimingSink : public EventSink {
+public:
+    void reset(size_t expected_frames) {
+        lateness.clear();
+        lateness.reserve(expected_frames);
+        events = 0;
+        first_ns = 0;
+        last_ns = 0;
+    }
+
+    size_t emit_frame(const MacroEvent*, size_t count, int64_t due_ns) override {
+        int64_t now = PlaybackScheduler::now_ns();
+        if (due_ns > 0) {
+            lateness.push_back(now - due_ns);
+        }
+        if (first_ns == 0) {
+            first_ns = now;
+        }
+        last_ns = now;
+        events += count;
+        return 1;
+    }
+
+    std::vector<int64_t> lateness;
+    size_t events = 0;
+    int64_t first_ns = 0;
+    int64_t last_ns = 0;
+};
+
+struct Scenario {
+    std::string name;
+    std::vector<MacroEvent> events;
+};
+
+void add_mouse_frame(std::vector<MacroEvent>& events, int64_t time_us) {
+    events.push_back({time_us, EV_REL, REL_X, 1});
+    events.push_back({time_us, EV_REL, REL_Y, -1});
+    events.push_back({time_us, EV_SYN, SYN_REPORT, 0});
+}
+
+std::vector<Scenario> make_scenarios(double seconds) {
+    int64_t duration_us = static_cast<int64_t>(seconds * 1000000);
+    std::vector<Scenario> scenarios;
+
+    Scenario mouse{"mouse_1khz", {}};
+    for (int64_t t = 0; t < duration_us; t += 1000) {
+        add_mouse_frame(mouse.events, t);
+    }
+    scenarios.push_back(std::move(mouse));
+
+    Scenario keys{"key_bursts", {}};
+    for (int64_t burst = 0; burst < duration_us; burst += 250000) {
+        for (int i = 0; i < 10; i++) {
+            uint16_t code = static_cast<uint16_t>(KEY_A + i);
+            keys.events.push_back({burst + i * 1000, EV_KEY, code, 1});
+            keys.events.push_back({burst + i * 1000 + 500, EV_KEY, code, 0});
+        }
+    }
+    scenarios.push_back(std::move(keys));
+
+    Scenario idle{"idle_gaps", {}};
+    for (int64_t t = 0; t < duration_us; t += 500000) {
+        add_mouse_frame(idle.events, t);
+    }
+    scenarios.push_back(std::move(idle));
+
+    Scenario flood{"flood", {}};
+    for (int i = 0; i < 100000; i++) {
+        add_mouse_frame(flood.events, 0);
+    }
+    scenarios.push_back(std::move(flood));
+
+    return scenarios;
+}
+
+double cpu_seconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void play_engine(const std::shared_ptr<const MacroFile>& macro, TimingSink& sink, int spin_us) {
+    PlaybackEngine engine(sink);
+    engine.set_spin_threshold_us(spin_us);
+
+    PlaybackRequest request;
+    request.name = "bench";
+    request.macro = macro;
+    request.warp_cursor = false;
+    uint64_t id = engine.start(request);
+
+    PlaybackStatus status;
+    while (engine.status(id, status) && status.state != PlaybackState::Finished) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+// The pre-engine player: gettimeofday-style elapsed time and relative sleeps.
+void play_legacy(const std::shared_ptr<const MacroFile>& macro, TimingSink& sink) {
+    MacroCursor cursor(*macro);
+    int64_t start = PlaybackScheduler::now_ns();
+    size_t count;
+    while (const MacroEvent* frame = cursor.next_frame(count)) {
+        int64_t due = start + frame->time_us * 1000;
+        int64_t remaining = due - PlaybackScheduler::now_ns();
+        if (remaining > 0) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
+        }
+        sink.emit_frame(frame, count, due);
+    }
+}
+
+void report(const std::string& scenario, const std::string& strategy, TimingSink& sink, double cpu) {
+    auto& samples = sink.lateness;
+    if (samples.empty()) {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()))] / 1000.0;
+    };
+
+    double wall = (sink.last_ns - sink.first_ns) / 1e9;
+    double rate = wall > 0 ? sink.events / wall : 0.0;
+    printf("%-12s %-16s %9zu %9.1f %9.1f %9.1f %12.0f %9.1f\n", scenario.c_str(), strategy.c_str(),
+           sink.events, percentile(0.5), percentile(0.99), samples.back() / 1000.0, rate, cpu * 1000);
+}
+
+}
+
+int main(int argc, char** argv) {
+    double seconds = 3.0;
+    std::vector<int> spins = {-1, 0, 20, 100};
+    bool legacy = true;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--duration" && i + 1 < argc) {
+            seconds = std::stod(argv[++i]);
+        } else if (arg == "--spin" && i + 1 < argc) {
+            spins = {std::stoi(argv[++i])};
+        } else if (arg == "--no-legacy") {
+            legacy = false;
+        } else {
+            std::cout << "Usage: " << argv[0] << " [--duration seconds] [--spin us|-1] [--no-legacy]" << std::endl;
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    std::string path = (fs::temp_directory_path() / "macrowise_bench.macro").string();
+    TimingSink sink;
+
+    printf("%-12s %-16s %9s %9s %9s %9s %12s %9s\n", "scenario", "strategy", "events",
+           "p50_us", "p99_us", "max_us", "events/s", "cpu_ms");
+
+    for (const auto& scenario : make_scenarios(seconds)) {
+        if (!utils::write_macro_file(path, MacroHeader{0, 0}, scenario.events)) {
+            std::cout << "Error writing " << path << std::endl;
+            return 1;
+        }
+        auto macro = std::make_shared<MacroFile>();
+        if (!macro->open(path)) {
+            std::cout << "Error opening " << path << std::endl;
+            return 1;
+        }
+
+        for (int spin : spins) {
+            sink.reset(macro->frame_count());
+            double cpu = cpu_seconds();
+            play_engine(macro, sink, spin);
+            std::string strategy = spin < 0 ? "engine/auto" : "engine/spin=" + std::to_string(spin);
+            report(scenario.name, strategy, sink, cpu_seconds() - cpu);
+        }
+
+        if (legacy) {
+            sink.reset(macro->frame_count());
+            double cpu = cpu_seconds();
+            play_legacy(macro, sink);
+            report(scenario.name, "legacy/sleep_for", sink, cpu_seconds() - cpu);
+        }
+    }
+
+    fs::remove(path);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+// Reads the INI-style files in config/: "[section]" headers followed by
+// "key = value" lines. '#' and ';' start comments.
+class Config {
+public:
+    bool load(const std::string& filename);
+
+    bool has(const std::string& section, const std::string& key) const;
+    std::string get(const std::string& section, const std::string& key, const std::string& fallback = "") const;
+    int get_int(const std::string& section, const std::string& key, int fallback) const;
+    bool get_bool(const std::string& section, const std::string& key, bool fallback) const;
+
+    const std::string& source() const { return filename; }
+
+private:
+    std::string filename;
+    std::map<std::string, std::string> values;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+class MacroRecorder;
+
+// Drives a MacroRecorder from scripts over a Unix stream socket. Requests
+// are single lines and every reply is one line starting with "OK" or "ERR":
+//
+//   play <name> [loops=N] [offset=S] [speed=X] [delay=S] [nowarp]
+//   playlist <name> [loops=N] [delay=S]
+//   stop <id>|all      record <name>      stoprecord
+//   status [id]        list               preload <name>
+//   ping               shutdown
+//
+// Requests are handled on the thread calling run(), straight into the
+// playback engine, so nothing is queued between the socket and the
+// scheduler.
+class ControlServer {
+public:
+    explicit ControlServer(MacroRecorder& recorder);
+    ~ControlServer();
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    // SIGINT and SIGTERM are read through a signalfd, so they have to be
+    // blocked before any thread starts; call this first thing in main().
+    static bool block_signals();
+
+    bool listen(const std::string& path, mode_t mode = 0600);
+    // Serves clients until a signal or a "shutdown" request.
+    void run();
+
+private:
+    static constexpr size_t MAX_CLIENTS = 32;
+    static constexpr size_t MAX_LINE = 4096;
+
+    struct Client {
+        int fd;
+        std::string input;
+    };
+
+    MacroRecorder& recorder;
+    std::string socket_path;
+    int listen_fd;
+    int signal_fd;
+    bool running;
+    std::vector<Client> clients;
+
+    void accept_clients();
+    bool serve(Client& client);
+    std::string handle(const std::string& line);
+    std::string play(const std::vector<std::string>& args);
+    std::string play_playlist(const std::vector<std::string>& args);
+    std::string status(const std::vector<std::string>& args);
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include <linux/input.h>
+
+enum DeviceCapability : unsigned int {
+    DEVICE_POINTER = 1u << 0,
+    DEVICE_KEYBOARD = 1u << 1,
+};
+
+struct InputDeviceInfo {
+    std::string path;
+    std::string name;
+    std::string phys;
+    input_id id{};
+    unsigned int capabilities = 0;
+    // Identify the node itself; a re-created node gets a new ctime.
+    dev_t rdev = 0;
+    timespec ctime{};
+
+    // Survives re-enumeration: bus:vendor:product/phys.
+    std::string key() const;
+};
+
+// Classifies /dev/input/event* nodes by their EVIOCGBIT capabilities and
+// keeps the list current through inotify. Probe results are cached on disk
+// per node, so a restart only opens nodes that changed since the last run.
+class DeviceRegistry {
+public:
+    DeviceRegistry();
+    ~DeviceRegistry();
+
+    DeviceRegistry(const DeviceRegistry&) = delete;
+    DeviceRegistry& operator=(const DeviceRegistry&) = delete;
+
+    void set_cache_file(const std::string& filename) { cache_file = filename; }
+    // Returns the number of devices found.
+    size_t scan(const std::string& dir = "/dev/input");
+    bool start_watching();
+    void stop_watching();
+
+    // spec is "auto", a device path or a stable key. A path is pinned to the
+    // device it first named, so the same device is found after a replug.
+    bool resolve(const std::string& spec, unsigned int capability, std::string& path);
+
+    std::vector<InputDeviceInfo> devices() const;
+    // Bumped on every hotplug change.
+    uint64_t generation() const { return change_count; }
+    size_t probe_count() const { return probes; }
+    void set_change_callback(std::function<void(const InputDeviceInfo&, bool)> callback);
+    void print() const;
+
+    static bool probe(const std::string& path, InputDeviceInfo& info);
+
+private:
+    std::string dir;
+    std::string cache_file;
+    std::map<std::string, InputDeviceInfo> known;
+    std::map<std::string, std::string> pins;
+    std::function<void(const InputDeviceInfo&, bool)> on_change;
+    mutable std::mutex mutex;
+
+    std::thread watcher;
+    std::atomic<bool> watching;
+    std::atomic<uint64_t> change_count;
+    std::atomic<size_t> probes;
+    int inotify_fd;
+
+    void watch_loop();
+    void handle_added(const std::string& path);
+    void handle_removed(const std::string& path);
+    std::map<std::string, InputDeviceInfo> load_cache() const;
+    void save_cache() const;
+};
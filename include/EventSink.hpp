@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "utils.hpp"
+
+// Destination for played-back frames. due_ns is the CLOCK_MONOTONIC time the
+// frame was scheduled for, or 0 for unscheduled frames such as key releases.
+// Returns the number of write() calls the frame took, 0 if none went out.
+class EventSink {
+public:
+    virtual ~EventSink() = default;
+    virtual size_t emit_frame(const MacroEvent* events, size_t count, int64_t due_ns = 0) = 0;
+};
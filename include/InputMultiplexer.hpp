@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <linux/input.h>
+#include "utils.hpp"
+
+// Watches any number of evdev nodes through one epoll set. Every ready fd is
+// drained with large reads and the per-device streams are merged by their
+// kernel timestamps, so frames from different devices come out in order.
+// Devices are switched to CLOCK_MONOTONIC, so ev.time is comparable with
+// utils::monotonic_time().
+//
+// When a device reports SYN_DROPPED the partial frame is discarded, events
+// up to the next SYN_REPORT are skipped, and synthetic EV_KEY events bring
+// the stream back in line with the kernel's key state (EVIOCGKEY).
+class InputMultiplexer {
+public:
+    InputMultiplexer();
+    ~InputMultiplexer();
+
+    InputMultiplexer(const InputMultiplexer&) = delete;
+    InputMultiplexer& operator=(const InputMultiplexer&) = delete;
+
+    // type_mask selects which EV_* types are kept (bit N = event type N);
+    // key_codes, if given, limits EV_KEY to those codes. Both are installed
+    // in the kernel with EVIOCSMASK where supported, so filtered events never
+    // wake us up, and are applied again here for older kernels.
+    bool add_device(const std::string& path, unsigned int type_mask = ~0u,
+                    const std::vector<uint16_t>& key_codes = {});
+    // Replaces the filters of an open device.
+    bool set_filter(const std::string& path, unsigned int type_mask, const std::vector<uint16_t>& key_codes);
+    void close_device(const std::string& path);
+    void close_all();
+
+    // EVIOCGRAB on every device, current and future: while grabbed no other
+    // client (X, the compositor, a game) sees their events.
+    bool set_grab(bool grab);
+    bool grabbed() const { return grab_enabled; }
+    // Grabbing while a key is down would strand its release with the desktop.
+    // Queries the kernel, so it is exact even for filtered codes.
+    bool any_key_down() const;
+
+    // Appends ready events to out. Returns the number appended, 0 on timeout
+    // or wake() and -1 on error.
+    int poll(std::vector<input_event>& out, int timeout_ms);
+    // Makes a blocked poll() return early; callable from any thread.
+    void wake();
+
+    size_t device_count() const;
+    bool is_open(const std::string& path) const;
+    // Number of SYN_DROPPED overruns seen across all devices.
+    size_t drop_count() const { return drops; }
+
+private:
+    struct Device {
+        std::string path;
+        int fd;
+        unsigned int type_mask;
+        bool filter_keys;
+        KeyState key_filter;
+        KeyState keys;
+        bool dropping;
+    };
+
+    static constexpr size_t READ_BATCH = 256;
+    static constexpr int MAX_READY = 16;
+    static constexpr uint32_t WAKE_INDEX = UINT32_MAX;
+
+    int epoll_fd;
+    int wake_fd;
+    std::vector<Device> devices;
+    input_event buffer[READ_BATCH];
+    size_t drops;
+    bool grab_enabled;
+
+    size_t drain(Device& device, std::vector<input_event>& out);
+    void resync(Device& device, const timeval& time, std::vector<input_event>& out);
+    void remove_device(Device& device);
+    static void set_key_filter(Device& device, const std::vector<uint16_t>& key_codes);
+    static void install_mask(const Device& device);
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/input.h>
+#include "InputMultiplexer.hpp"
+#include "RealTime.hpp"
+
+class DeviceRegistry;
+
+// The one thread that reads evdev devices. Components acquire the devices
+// they need, each with its own filter, and subscribe to the merged stream.
+// A device acquired several times is opened once with the union of the
+// filters, so every event is read once and handed to every subscriber.
+class InputReactor {
+public:
+    // Runs on the reactor thread; it must not block.
+    using Subscriber = std::function<void(const input_event* events, size_t count)>;
+
+    InputReactor();
+    ~InputReactor();
+
+    InputReactor(const InputReactor&) = delete;
+    InputReactor& operator=(const InputReactor&) = delete;
+
+    // Specs are resolved through the registry, which is also followed for
+    // hotplug. Without one, specs must be device paths.
+    void set_device_registry(DeviceRegistry* devices);
+    // Applied when the reactor thread starts.
+    void set_realtime(const RealTimeOptions& options) { realtime = options; }
+
+    // Waits until the reactor thread has opened the device. Returns 0 when
+    // no device matches spec or it cannot be opened. Empty key_codes means
+    // all keys.
+    uint64_t acquire(const std::string& spec, unsigned int capability, unsigned int type_mask = ~0u,
+                     const std::vector<uint16_t>& key_codes = {});
+    void release(uint64_t id);
+    // The device node spec currently names.
+    bool resolve(const std::string& spec, unsigned int capability, std::string& path);
+
+    uint64_t subscribe(Subscriber callback);
+    // Once this returns the callback is not running and will not run again,
+    // except when it is called from a subscriber itself.
+    void unsubscribe(uint64_t id);
+
+    // Devices are grabbed (EVIOCGRAB) while any hold is outstanding. The grab
+    // waits until no key is down.
+    void hold_grab();
+    void release_grab();
+
+    // Re-resolves every acquisition, e.g. after a device was replugged.
+    void refresh();
+    void stop();
+
+    size_t drop_count() const { return drops; }
+
+private:
+    struct Acquisition {
+        std::string spec;
+        unsigned int capability;
+        unsigned int type_mask;
+        std::vector<uint16_t> key_codes;
+    };
+
+    struct Filter {
+        unsigned int type_mask = 0;
+        bool all_keys = false;
+        std::set<uint16_t> key_codes;
+
+        bool operator==(const Filter& other) const {
+            return type_mask == other.type_mask && all_keys == other.all_keys && key_codes == other.key_codes;
+        }
+    };
+
+    InputMultiplexer input;
+    DeviceRegistry* registry;
+    RealTimeOptions realtime;
+
+    mutable std::mutex mutex;
+    std::map<uint64_t, Acquisition> acquisitions;
+    std::map<uint64_t, std::shared_ptr<Subscriber>> subscribers;
+    uint64_t next_id;
+    // acquire() waits for sync_devices() to catch up with its request.
+    uint64_t sync_requested;
+    uint64_t sync_done;
+    std::condition_variable synced;
+    // Paths open after the last sync_devices().
+    std::set<std::string> open_paths;
+    int grab_holds;
+    bool dirty;
+    bool replugged;
+    bool running;
+    std::thread worker;
+    std::atomic<size_t> drops;
+
+    // Held while subscribers run, so unsubscribe() can wait them out.
+    std::mutex dispatch_mutex;
+
+    // Reactor thread only: what each open device was opened with.
+    std::map<std::string, Filter> opened;
+
+    void ensure_running();
+    void run();
+    void sync_devices(bool report);
+};
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <map>
 #include <string>
 #include <vector>
 #include <functional>
 #include <ncurses.h>
+#include "PlaybackEngine.hpp"
+#include "MacroIndex.hpp"
 
 class Interface {
 public:
@@ -13,31 +17,68 @@ public:
     void run();
     void show_menu();
     void show_recording_screen(const std::string& macro_name);
+    void watch_recording();
     void show_playback_screen(const std::string& macro_name, int loop_count);
-    void show_macros_list(const std::vector<std::string>& macros);
+    void watch_playback(uint64_t id);
+    // Scrollable table; keys re-sort and filter it in place.
+    void show_macros_list();
     void show_message(const std::string& message);
     void show_error(const std::string& error);
     
     void set_recording_callback(std::function<void(const std::string&)> callback);
-    void set_playback_callback(std::function<void(const std::string&, int)> callback);
-    void set_list_callback(std::function<std::vector<std::string>()> callback);
+    void set_playback_callback(std::function<uint64_t(const std::string&, int, double, double)> callback);
+    void set_playlist_callback(std::function<uint64_t(const std::string&, int)> callback);
+    void set_playback_status_callback(std::function<bool(uint64_t, PlaybackStatus&)> callback);
+    void set_stop_playback_callback(std::function<void(uint64_t)> callback);
+    void set_list_callback(std::function<std::vector<MacroInfo>(const std::string&, MacroSort, bool)> callback);
     void set_stop_recording_callback(std::function<void()> callback);
     void set_recording_status_callback(std::function<bool()> callback);
+    void set_optimize_callback(std::function<std::string(const std::string&)> callback);
+    void set_recorded_events_callback(std::function<size_t()> callback);
+
+    // Safe from any thread: wakes the UI loop to redraw live fields. Calls
+    // are coalesced, so it can be signalled per frame.
+    void notify();
+    // Leaves run() as soon as the current screen allows; any thread.
+    void request_exit();
     
 private:
+    // Live screens repaint at most this often, however busy the engine is.
+    static constexpr int64_t FRAME_MS = 33;
+
+
     WINDOW* main_win;
     WINDOW* status_win;
     
     std::function<void(const std::string&)> recording_callback;
-    std::function<void(const std::string&, int)> playback_callback;
-    std::function<std::vector<std::string>()> list_callback;
+    std::function<uint64_t(const std::string&, int, double, double)> playback_callback;
+    std::function<uint64_t(const std::string&, int)> playlist_callback;
+    std::function<bool(uint64_t, PlaybackStatus&)> playback_status_callback;
+    std::function<void(uint64_t)> stop_playback_callback;
+    std::function<std::vector<MacroInfo>(const std::string&, MacroSort, bool)> list_callback;
     std::function<void()> stop_recording_callback;
     std::function<bool()> recording_status_callback;
+    std::function<std::string(const std::string&)> optimize_callback;
+    std::function<size_t()> recorded_events_callback;
+
+    int wake_fd;
+    std::atomic<bool> wake_pending;
+    std::atomic<bool> exit_requested;
+    bool dirty;
+    int64_t last_draw_ms;
+    std::string status_text;
+    std::map<int, std::string> fields;
     
     void init_colors();
     void draw_border();
     void clear_status();
     void update_status(const std::string& message);
+    void clear_screen();
+    void set_field(int row, const std::string& text);
+    int wait_key(int timeout_ms, bool watch_updates);
+    int wait_for_key();
+    int next_event(bool& redraw, int idle_ms);
     std::string get_input(const std::string& prompt);
     int get_number_input(const std::string& prompt);
+    double get_decimal_input(const std::string& prompt, double fallback);
 };
\ No newline at end of file
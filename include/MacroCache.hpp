@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/types.h>
+#include "MacroFile.hpp"
+
+// Bounded LRU of loaded macros keyed by path. Entries are revalidated against
+// the file's mtime and size on every lookup; playback threads share them.
+class MacroCache {
+public:
+    explicit MacroCache(size_t capacity = 16);
+
+    std::shared_ptr<const MacroFile> get(const std::string& filename);
+    void invalidate(const std::string& filename);
+    void clear();
+    void set_capacity(size_t entries);
+
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+    size_t size() const;
+
+private:
+    struct Entry {
+        std::string path;
+        timespec mtime;
+        off_t file_size;
+        std::shared_ptr<const MacroFile> macro;
+    };
+
+    size_t capacity;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    mutable std::mutex mutex;
+    std::atomic<size_t> hit_count;
+    std::atomic<size_t> miss_count;
+
+    void evict();
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "utils.hpp"
+
+// Compact .macro payload: a dictionary of the (type, code) pairs used by the
+// recording, followed by one record per event made of three varints:
+// dictionary index, zigzag time delta in microseconds and zigzag value.
+struct EventKey {
+    uint16_t type;
+    uint16_t code;
+};
+
+namespace utils {
+    void encode_compact(const std::vector<MacroEvent>& events, std::vector<uint8_t>& out);
+    bool decode_dictionary(const uint8_t* data, size_t size, std::vector<EventKey>& dictionary, size_t& consumed);
+}
+
+// Streaming decoder over a compact event stream; keeps no per-event storage.
+class CompactDecoder {
+public:
+    CompactDecoder();
+
+    void reset(const uint8_t* data, size_t size, const std::vector<EventKey>* dictionary);
+    void seek(size_t offset, int64_t time_us);
+    bool next(MacroEvent& ev);
+
+    size_t offset() const { return position; }
+    int64_t time_us() const { return last_time; }
+
+private:
+    const uint8_t* stream;
+    size_t stream_size;
+    size_t position;
+    int64_t last_time;
+    const std::vector<EventKey>* keys;
+
+    bool read_varint(uint64_t& value);
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "utils.hpp"
+#include "MacroCodec.hpp"
+
+constexpr char MACRO_MAGIC[4] = {'M', 'W', 'M', 'F'};
+constexpr uint16_t MACRO_VERSION = 2;
+
+enum MacroEncoding : uint16_t {
+    MACRO_ENCODING_RAW = 0,
+    MACRO_ENCODING_COMPACT = 1,
+};
+
+// On-disk header of a versioned .macro file. The payload starts at
+// header_size: an array of MacroEvent records for raw files, or a
+// dictionary plus varint stream (see MacroCodec.hpp) for compact ones.
+// The checksum covers the whole payload.
+struct MacroFileHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t encoding;
+    int32_t start_x;
+    int32_t start_y;
+    uint64_t event_count;
+    uint64_t frame_count;
+    int64_t duration_us;
+    uint32_t checksum;
+    uint32_t header_size;
+};
+
+static_assert(sizeof(MacroFileHeader) == 48, "MacroFileHeader layout changed");
+
+// Snapshot taken at a frame boundary roughly every KEYFRAME_INTERVAL_US of
+// macro time. Holds where decoding resumes and which keys are down there.
+struct MacroKeyframe {
+    int64_t time_us;
+    size_t event_index;
+    size_t stream_offset;
+    int64_t stream_time_us;
+    KeyState keys;
+};
+
+// A loaded macro. Versioned files are mapped read-only and played straight
+// from the mapping; legacy files are converted into an owned buffer.
+// events() is only available for raw payloads, use MacroCursor otherwise.
+class MacroFile {
+public:
+    MacroFile();
+    ~MacroFile();
+
+    MacroFile(const MacroFile&) = delete;
+    MacroFile& operator=(const MacroFile&) = delete;
+
+    bool open(const std::string& filename, bool verify_checksum = false);
+    void close();
+
+    const MacroFileHeader& header() const { return info; }
+    int start_x() const { return info.start_x; }
+    int start_y() const { return info.start_y; }
+    const MacroEvent* events() const { return event_data; }
+    size_t size() const { return static_cast<size_t>(info.event_count); }
+    size_t frame_count() const { return static_cast<size_t>(info.frame_count); }
+    int64_t duration_us() const { return info.duration_us; }
+    bool is_legacy() const { return legacy; }
+    bool is_compact() const { return info.encoding == MACRO_ENCODING_COMPACT; }
+    void prefault() const;
+
+    static constexpr int64_t KEYFRAME_INTERVAL_US = 1000000;
+    // Built on first use and shared by every cursor over this file.
+    const std::vector<MacroKeyframe>& keyframes() const;
+
+private:
+    friend class MacroCursor;
+
+    MacroFileHeader info;
+    void* mapping;
+    size_t mapping_size;
+    const MacroEvent* event_data;
+    std::vector<MacroEvent> owned;
+    std::vector<EventKey> dictionary;
+    const uint8_t* stream;
+    size_t stream_size;
+    bool legacy;
+    mutable std::mutex keyframe_mutex;
+    mutable bool keyframes_built;
+    mutable std::vector<MacroKeyframe> keyframe_index;
+
+    bool open_legacy(const std::string& filename);
+};
+
+// Walks a MacroFile frame by frame. Raw files hand out pointers into the
+// mapping; compact files are decoded incrementally into a small buffer.
+class MacroCursor {
+public:
+    explicit MacroCursor(const MacroFile& file);
+
+    void rewind();
+    // Returns the next frame, valid until the next call, or nullptr at the end.
+    const MacroEvent* next_frame(size_t& count);
+    // Positions the cursor on the first frame at or after time_us and
+    // reports the keys held at that point.
+    void seek(int64_t time_us, KeyState& keys);
+
+private:
+    const MacroFile& file;
+    size_t position;
+    const MacroEvent* last_frame;
+    size_t last_count;
+    bool replay;
+    CompactDecoder decoder;
+    std::vector<MacroEvent> frame;
+    MacroEvent lookahead;
+    bool has_lookahead;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+struct MacroInfo {
+    std::string name;
+    // Identify the file version the rest was read from.
+    uint64_t size = 0;
+    timespec mtime{};
+    ino_t inode = 0;
+
+    int64_t duration_us = 0;
+    uint64_t event_count = 0;
+    uint64_t frame_count = 0;
+    uint64_t key_events = 0;
+    uint64_t rel_events = 0;
+    uint64_t syn_events = 0;
+    uint64_t other_events = 0;
+    // Where the cursor is warped at the start of every loop.
+    int start_x = 0;
+    int start_y = 0;
+    uint32_t checksum = 0;
+    std::string encoding;
+};
+
+enum class MacroSort {
+    Name,
+    Duration,
+    Events,
+    Size,
+    Modified,
+};
+
+// Metadata for every .macro in the macros directory, persisted next to them
+// in .index. refresh() only stats the directory and reopens files whose
+// size, mtime or inode changed, so listing a large library stays cheap.
+class MacroIndex {
+public:
+    MacroIndex();
+
+    void set_directory(const std::string& dir);
+    // Returns the number of macros that had to be read.
+    size_t refresh();
+    // For a macro just written or rewritten; cheaper than a refresh.
+    bool update(const std::string& name);
+
+    // Case-insensitive substring match on the name; empty matches all.
+    std::vector<MacroInfo> query(const std::string& filter = "", MacroSort sort = MacroSort::Name,
+                                 bool descending = false) const;
+    size_t probe_count() const { return probes; }
+
+    static bool probe(const std::string& filename, MacroInfo& info);
+
+private:
+    std::string macros_dir;
+    std::string index_file;
+    std::map<std::string, MacroInfo> known;
+    bool loaded;
+    mutable std::mutex mutex;
+    std::atomic<size_t> probes;
+
+    std::map<std::string, MacroInfo> load_index() const;
+    void save_index() const;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "utils.hpp"
+
+struct OptimizeOptions {
+    bool enabled = true;
+    bool drop_misc = true;
+    bool drop_key_repeats = true;
+    bool drop_empty_frames = true;
+    // Rebases the timeline to the first event and, when max_idle_us > 0,
+    // shortens longer gaps between frames to max_idle_us.
+    bool trim_idle = false;
+    int64_t max_idle_us = 0;
+};
+
+struct OptimizeStats {
+    size_t events_in = 0;
+    size_t events_out = 0;
+    size_t misc_dropped = 0;
+    size_t repeats_dropped = 0;
+    size_t empty_frames_dropped = 0;
+    int64_t idle_trimmed_us = 0;
+
+    size_t removed() const { return events_in - events_out; }
+    std::string summary() const;
+};
+
+// The optimizer as a streaming filter, so a recording is optimized on its
+// way to disk. apply() compacts each chunk in place and returns how many
+// events were kept; chunks must be passed in order.
+class MacroFilter {
+public:
+    explicit MacroFilter(const OptimizeOptions& options);
+
+    size_t apply(MacroEvent* events, size_t count);
+    const OptimizeStats& stats() const { return totals; }
+
+private:
+    OptimizeOptions options;
+    OptimizeStats totals;
+    // Last kept event, before idle trimming.
+    MacroEvent last;
+    bool has_last;
+    int64_t shift;
+};
+
+namespace utils {
+    OptimizeStats optimize_macro(std::vector<MacroEvent>& events, const OptimizeOptions& options);
+}
@@ -1,37 +1,141 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <linux/input.h>
 #include "utils.hpp"
+#include "UInputDevice.hpp"
+#include "SpscRing.hpp"
+#include "RealTime.hpp"
+#include "MacroCache.hpp"
+#include "MacroIndex.hpp"
+#include "MacroOptimizer.hpp"
+#include "PlaybackEngine.hpp"
+#include "InputReactor.hpp"
+
+class MacroWriter;
+class DeviceRegistry;
 
 class MacroRecorder {
 public:
+    // Devices are "auto", a path or a registry key; see DeviceRegistry::resolve.
     MacroRecorder(const std::string& mouse_device, const std::string& keyboard_device);
     ~MacroRecorder();
     
+    // Blocks until stop_recording(); begin_recording() runs it on a thread.
     void start_recording(const std::string& macro_name);
+    bool begin_recording(const std::string& macro_name);
     void stop_recording();
-    void play_macro(const std::string& macro_name, int loop_count = 1);
+    // start_offset_s resumes the first loop partway; speed scales all delays.
+    // Returns the playback id for stop_playback(), or 0 on failure, including
+    // options outside the PlaybackRequest bounds.
+    uint64_t play_macro(const std::string& macro_name, int loop_count = 1, double start_offset_s = 0, double speed = 1.0);
+    // Plays with the given options as is: no start_delay is added.
+    uint64_t play_macro(const std::string& macro_name, PlaybackRequest request);
+    // Loads a macro into the cache and faults its pages in ahead of playback.
+    bool preload_macro(const std::string& macro_name);
+    // Plays <name>.playlist as one sequence, loop_count times (-1 endless).
+    // Each entry is loaded while the previous one plays and takes over on
+    // the same timeline, without a start delay or loop gap in between.
+    uint64_t play_playlist(const std::string& playlist_name, int loop_count = 1, int64_t delay_us = 0);
+    void stop_playback(uint64_t id);
+    void stop_all_playback();
     void list_macros() const;
+    std::string optimize_macro(const std::string& macro_name);
+    bool prepare_playback();
     
+    // Stays true after stop_recording() until the macro is saved.
     bool is_recording() const { return recording; }
+    size_t recorded_event_count() const { return recorded_events; }
     bool should_exit() const { return should_exit_flag; }
+    const std::string& macros_directory() const { return macros_dir; }
+    const MacroCache& macro_cache() const { return cache; }
+    MacroIndex& macro_index() { return index; }
+    const PlaybackEngine& playback_engine() const { return engine; }
+    InputReactor& input_reactor() { return reactor; }
     
-    void set_macros_directory(const std::string& dir) { macros_dir = dir; }
+    void set_macros_directory(const std::string& dir) {
+        macros_dir = dir;
+        index.set_directory(dir);
+        engine.set_stats_directory(dir);
+    }
     void set_start_delay(int delay) { start_delay = delay; }
+    int start_delay_seconds() const { return start_delay; }
+    // Final stretch before each event that is busy-waited; -1 calibrates it.
+    void set_spin_threshold_us(int threshold) { engine.set_spin_threshold_us(threshold); }
+    void set_compact_storage(bool compact) { compact_storage = compact; }
+    // EVIOCGRAB the input devices while recording or while any macro plays,
+    // so nothing reaches other clients. Hotkeys keep working.
+    void set_exclusive_grab(bool grab) { exclusive_grab = grab; }
+    void set_playback_grab(bool grab) { playback_grab = grab; }
+    void set_realtime(const RealTimeOptions& options) {
+        realtime = options;
+        engine.set_realtime(options);
+        reactor.set_realtime(options);
+    }
+    void set_optimize_options(const OptimizeOptions& options) { optimize_options = options; }
+    void set_cache_capacity(size_t entries) { cache.set_capacity(entries); }
+    // Recorded alongside the mouse and keyboard. Devices with absolute axes
+    // are skipped with a message, since playback has no EV_ABS.
+    void add_input_device(const std::string& device) { extra_devices.push_back(device); }
+    // Without a registry the configured devices must be plain paths.
+    void set_device_registry(DeviceRegistry* devices) { reactor.set_device_registry(devices); }
+    // Signalled as recording and playback make progress, from their threads.
+    void set_progress_callback(std::function<void()> callback);
     
 private:
     std::string mouse_device;
     std::string keyboard_device;
+    std::vector<std::string> extra_devices;
     std::string macros_dir;
     int start_delay;
+    bool compact_storage;
+    bool exclusive_grab;
+    bool playback_grab;
+    RealTimeOptions realtime;
+    OptimizeOptions optimize_options;
     
     std::atomic<bool> recording;
+    // Cleared by stop_recording() to end the capture; recording follows once
+    // the file is written.
+    std::atomic<bool> capturing;
     std::atomic<bool> should_exit_flag;
-    std::vector<input_event> events;
-    timeval start_time;
+    std::atomic<size_t> recorded_events;
+    std::atomic<bool> playback_grabbed;
+    std::mutex record_mutex;
+    std::condition_variable record_stopped;
+    std::thread record_thread;
+    std::function<void()> on_progress;
+    std::mutex progress_mutex;
+
+    struct Prefetcher {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+    std::vector<Prefetcher> prefetchers;
+    std::mutex prefetch_mutex;
+
+    // Decouples the device-reading loop from disk I/O while recording.
+    using RecordRing = SpscRing<MacroEvent, 1 << 17>;
+
+    // Declared first so it outlives the engine, whose callbacks use it.
+    InputReactor reactor;
+    UInputDevice uinput;
+    std::mutex uinput_mutex;
+    MacroCache cache;
+    MacroIndex index;
+    PlaybackEngine engine;
     
-    void record_events();
-    void play_macro_loop(const std::vector<input_event>& macro_events, int start_x, int start_y, int loop_count);
+    bool write_events(RecordRing& ring, MacroWriter& writer, MacroFilter* filter,
+                      const std::atomic<bool>& capture_done);
+    bool claim_recording();
+    void record(const std::string& macro_name);
+    bool load_entry(PlaybackRequest& entry);
+    void prefetch_playlist(uint64_t id, std::vector<PlaybackRequest> entries, int loop_count);
+    void report_progress();
+    void on_engine_progress();
 };
\ No newline at end of file
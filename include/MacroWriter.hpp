@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "MacroFile.hpp"
+
+// Streams raw MacroEvent records to a versioned .macro file. Events go to
+// <name>.tmp next to it, which finish() renames over the target, so an
+// existing macro is only replaced by a complete recording; discard() keeps
+// it. flush() makes everything appended so far durable and rewrites the
+// header, so a crash mid-recording still leaves a playable .tmp behind.
+class MacroWriter {
+public:
+    MacroWriter();
+    ~MacroWriter();
+
+    MacroWriter(const MacroWriter&) = delete;
+    MacroWriter& operator=(const MacroWriter&) = delete;
+
+    bool open(const std::string& filename, const MacroHeader& header);
+    bool append(const MacroEvent* events, size_t count);
+    bool flush();
+    bool finish();
+    void discard();
+
+    size_t event_count() const { return static_cast<size_t>(info.event_count); }
+    const std::string& filename() const { return path; }
+
+private:
+    int fd;
+    std::string path;
+    std::string tmp_path;
+    MacroFileHeader info;
+    uint32_t crc;
+    MacroEvent last;
+
+    bool write_header();
+};
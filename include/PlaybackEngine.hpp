@@ -0,0 +1,199 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "MacroFile.hpp"
+#include "PlaybackScheduler.hpp"
+#include "RealTime.hpp"
+#include "PlaybackStats.hpp"
+#include "EventSink.hpp"
+
+enum class PlaybackState {
+    Waiting,
+    Playing,
+    Finished,
+    Stopped,
+};
+
+struct PlaybackStatus {
+    uint64_t id = 0;
+    std::string name;
+    PlaybackState state = PlaybackState::Waiting;
+    int current_loop = 0;
+    int loop_count = 0;
+    size_t frames_emitted = 0;
+    std::shared_ptr<const PlaybackStats> stats;
+    // Set for a sequence such as a playlist; name is then its current entry,
+    // counted from 1 by segment.
+    std::string sequence;
+    int segment = 1;
+};
+
+struct PlaybackRequest {
+    // Bounds that keep every offset / speed well inside int64 nanoseconds.
+    static constexpr double MIN_SPEED = 0.01;
+    static constexpr double MAX_SPEED = 100.0;
+    static constexpr double MAX_OFFSET_S = 86400.0 * 365;
+
+    std::string name;
+    std::shared_ptr<const MacroFile> macro;
+    int loop_count = 1;
+    int64_t start_offset_us = 0;
+    double speed = 1.0;
+    int64_t delay_us = 0;
+    bool warp_cursor = true;
+    // Pause LOOP_GAP_NS before the first loop as well, not just between loops.
+    bool lead_in = true;
+    // Only read from the first request of a sequence. An open one waits for
+    // further segments through append() until it is sealed.
+    std::string sequence;
+    bool open = false;
+
+    static bool valid_speed(double value) { return value >= MIN_SPEED && value <= MAX_SPEED; }
+    static bool valid_offset(double seconds) { return seconds >= 0 && seconds <= MAX_OFFSET_S; }
+    bool valid() const {
+        return valid_speed(speed) && valid_offset(start_offset_us / 1e6) && valid_offset(delay_us / 1e6);
+    }
+};
+
+// Plays any number of macros on one scheduler thread. Every active macro
+// has a single pending deadline in a min-heap; the thread sleeps until the
+// earliest one, emits that frame to the shared sink and reschedules.
+class PlaybackEngine {
+public:
+    explicit PlaybackEngine(EventSink& sink);
+    ~PlaybackEngine();
+
+    PlaybackEngine(const PlaybackEngine&) = delete;
+    PlaybackEngine& operator=(const PlaybackEngine&) = delete;
+
+    // Starts the scheduler thread (and its spin calibration) ahead of the
+    // first start(), so that one begins without the setup cost.
+    void warm_up();
+    uint64_t start(const PlaybackRequest& request);
+    // Queues the next segment of an open playback. It takes over on the same
+    // timeline once the current one finishes its loops, after its delay_us.
+    bool append(uint64_t id, const PlaybackRequest& next);
+    // No more segments follow; the playback ends after the queued ones.
+    void seal(uint64_t id);
+    // Blocks until nothing is queued for the playback any more. Returns false
+    // once it has ended.
+    bool wait_drained(uint64_t id);
+    bool stop(uint64_t id);
+    void stop_all();
+    bool status(uint64_t id, PlaybackStatus& out) const;
+    std::vector<PlaybackStatus> list() const;
+    // Lock-free, so it is safe inside the progress callback.
+    size_t active_count() const { return active_playbacks; }
+
+    // Applied when the scheduler thread starts; -1 calibrates the spin.
+    void set_spin_threshold_us(int threshold) { spin_threshold_us = threshold; }
+    void set_realtime(const RealTimeOptions& options) { realtime = options; }
+    // Where <name>.stats.json is written when a playback ends; empty disables.
+    void set_stats_directory(const std::string& dir);
+    // Called on the scheduler thread after every frame and state change;
+    // it must return quickly.
+    void set_progress_callback(std::function<void()> callback);
+
+private:
+    static constexpr int64_t LOOP_GAP_NS = 100000000;
+    static constexpr size_t FINISHED_HISTORY = 64;
+
+    // Each loop starts with a cursor warp, then its frames follow after
+    // LOOP_GAP_NS, matching the pauses of the original per-thread player.
+    // A sequence moves to its next segment without that pause.
+    enum class Step {
+        LoopStart,
+        Frame,
+    };
+
+    struct Playback {
+        PlaybackStatus info;
+        std::shared_ptr<const MacroFile> macro;
+        std::unique_ptr<MacroCursor> cursor;
+        std::deque<PlaybackRequest> queued;
+        PlaybackScheduler clock;
+        std::shared_ptr<PlaybackStats> stats;
+        KeyState held;
+        int64_t start_offset_us;
+        bool warp_cursor;
+        // Set by begin_loop(); run() warps outside the lock, then starts the loop.
+        bool warp_pending;
+        bool lead_in;
+        bool open;
+        // Ran out of segments while still open; append() resumes it.
+        bool starved;
+        Step step;
+        const MacroEvent* frame;
+        size_t frame_size;
+        int64_t due_ns;
+        int64_t loop_started_ns;
+        bool stop_requested;
+
+        Playback(const PlaybackRequest& request, uint64_t id);
+    };
+
+    struct Deadline {
+        int64_t time_ns;
+        uint64_t sequence;
+        uint64_t id;
+
+        bool operator>(const Deadline& other) const {
+            return time_ns != other.time_ns ? time_ns > other.time_ns : sequence > other.sequence;
+        }
+    };
+
+    struct StatsDump {
+        std::shared_ptr<const PlaybackStats> stats;
+        std::string filename;
+        std::string name;
+        int64_t now_ns;
+        uint64_t id;
+    };
+
+    EventSink& sink;
+    int spin_threshold_us;
+    RealTimeOptions realtime;
+    std::string stats_dir;
+    std::function<void()> on_progress;
+
+    mutable std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable drained;
+    std::thread worker;
+    bool running;
+    std::atomic<size_t> active_playbacks;
+    uint64_t next_id;
+    uint64_t next_sequence;
+    std::unordered_map<uint64_t, std::unique_ptr<Playback>> active;
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines;
+    std::deque<PlaybackStatus> finished;
+    std::vector<MacroEvent> key_frame;
+
+    // Stats dumps are written on their own thread, drained before the
+    // engine is destroyed.
+    std::mutex dump_mutex;
+    std::condition_variable dump_ready;
+    std::deque<StatsDump> dumps;
+    std::thread dump_worker;
+    bool dump_stopping;
+
+    void run();
+    void write_dumps();
+    void schedule(uint64_t id, int64_t time_ns);
+    void advance(Playback& playback, int64_t now_ns);
+    void begin_loop(Playback& playback, int64_t now_ns);
+    void start_loop(Playback& playback, int64_t now_ns);
+    bool next_segment(Playback& playback);
+    void finish(Playback& playback, PlaybackState state);
+};
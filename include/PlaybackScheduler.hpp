@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <sys/time.h>
+
+// Waits for absolute CLOCK_MONOTONIC deadlines measured from an anchor.
+// Long gaps are slept with clock_nanosleep(TIMER_ABSTIME); the final
+// spin_threshold nanoseconds are busy-waited to hide timer slack.
+class PlaybackScheduler {
+public:
+    static constexpr int64_t DEFAULT_SPIN_NS = 50000;
+    static constexpr int64_t MIN_SPIN_NS = 5000;
+    static constexpr int64_t MAX_SPIN_NS = 1000000;
+
+    PlaybackScheduler();
+
+    // Anchors the timeline so that offset_ns (in macro time) is due now.
+    void start(int64_t offset_ns = 0);
+    // Same, but offset_ns becomes due at the absolute time time_ns instead.
+    void start_at(int64_t time_ns, int64_t offset_ns = 0);
+    int64_t anchor_ns() const { return anchor; }
+    int64_t deadline(int64_t offset_ns) const { return anchor + scaled(offset_ns); }
+
+    // Playback speed factor; 2.0 plays twice as fast.
+    void set_speed(double factor);
+    double speed() const { return speed_factor; }
+
+    // Blocks until anchor + offset / speed and returns how late it woke, in ns.
+    int64_t wait_until(int64_t offset_ns);
+    int64_t wait_until(const timeval& offset) { return wait_until(to_ns(offset)); }
+
+    void set_spin_threshold_ns(int64_t ns);
+    int64_t spin_threshold_ns() const { return spin_threshold; }
+
+    // Measures clock_nanosleep overshoot on this host and adopts a spin
+    // threshold that covers it. Returns the chosen threshold.
+    int64_t calibrate();
+
+    static int64_t now_ns();
+    static void spin_until(int64_t deadline_ns);
+    static int64_t to_ns(const timeval& tv) {
+        return static_cast<int64_t>(tv.tv_sec) * 1000000000LL + static_cast<int64_t>(tv.tv_usec) * 1000LL;
+    }
+
+private:
+    int64_t anchor;
+    int64_t spin_threshold;
+    double speed_factor;
+
+    int64_t scaled(int64_t offset_ns) const;
+
+    static void sleep_until(int64_t deadline_ns);
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Lock-free histogram with power-of-two nanosecond buckets: bucket i counts
+// samples below 2^i ns. Safe to record from one thread while others read.
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 40;
+
+    LatencyHistogram();
+
+    void record(int64_t ns);
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    int64_t max() const { return max_ns.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the given quantile (0..1).
+    int64_t percentile(double quantile) const;
+    uint64_t bucket(size_t index) const { return counts[index].load(std::memory_order_relaxed); }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> counts;
+    std::atomic<uint64_t> total;
+    std::atomic<int64_t> max_ns;
+};
+
+struct PlaybackStatsSnapshot {
+    uint64_t frames = 0;
+    uint64_t events = 0;
+    uint64_t writes = 0;
+    uint64_t loops = 0;
+    double elapsed_s = 0.0;
+    double events_per_s = 0.0;
+    int64_t last_loop_ns = 0;
+    int64_t p50_ns = 0;
+    int64_t p99_ns = 0;
+    int64_t max_ns = 0;
+};
+
+// Per-playback instrumentation written by the engine thread and read live
+// by the UI. Lateness is measured right before each frame is emitted.
+class PlaybackStats {
+public:
+    PlaybackStats();
+
+    void start(int64_t now_ns) { started_ns = now_ns; }
+    void stop(int64_t now_ns) { stopped_ns = now_ns; }
+    void record_frame(int64_t lateness_ns, size_t event_count);
+    // Counts every write() to the device, including split frames and key releases.
+    void record_writes(size_t count);
+    void record_loop(int64_t duration_ns);
+
+    PlaybackStatsSnapshot snapshot(int64_t now_ns) const;
+    std::string to_json(const std::string& name, int64_t now_ns) const;
+    // tag keeps the temporary apart from other dumps to the same file.
+    bool write_json(const std::string& filename, const std::string& name, int64_t now_ns, uint64_t tag = 0) const;
+
+    const LatencyHistogram& lateness() const { return lateness_histogram; }
+
+private:
+    LatencyHistogram lateness_histogram;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> events;
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> loops;
+    std::atomic<int64_t> last_loop_ns;
+    std::atomic<int64_t> min_loop_ns;
+    std::atomic<int64_t> max_loop_ns;
+    std::atomic<int64_t> started_ns;
+    std::atomic<int64_t> stopped_ns;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "PlaybackEngine.hpp"
+
+// A <name>.playlist file in the macros directory: one macro per line, with
+// the options of the daemon's play request. '#' starts a comment.
+//
+//   farm_start
+//   farm_loop loops=20 speed=1.1
+//   farm_end offset=2.5 delay=0.5 nowarp
+//
+// delay is a pause before the entry; without one it follows the previous
+// entry with no gap. Entries come back with name and options set, the
+// macros themselves are loaded at play time.
+class Playlist {
+public:
+    bool load(const std::string& filename);
+
+    const std::vector<PlaybackRequest>& entries() const { return items; }
+
+    // Applies "loops=N offset=S speed=X delay=S nowarp" from words[first]
+    // on; on failure error holds the word that was not understood.
+    static bool parse_options(const std::vector<std::string>& words, size_t first, PlaybackRequest& request,
+                              std::string& error);
+    static std::vector<std::string> split_words(const std::string& line);
+    // Names map straight to files in the macros directory.
+    static bool valid_name(const std::string& name);
+
+private:
+    std::vector<PlaybackRequest> items;
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+struct RealTimeOptions {
+    bool enabled = false;
+    int priority = 50;
+    int cpu = -1;
+    bool lock_memory = true;
+};
+
+namespace utils {
+    // Puts the calling thread into SCHED_FIFO at the given priority, pins it
+    // to options.cpu, locks process memory and drops timer slack to 1 ns.
+    // Each step that lacks privileges is skipped with a printed reason;
+    // returns true only if every requested step succeeded.
+    bool enter_realtime(const RealTimeOptions& options);
+    void prefault_memory(const void* data, size_t size);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Fixed-size lock-free ring for exactly one producer and one consumer thread.
+// Neither side allocates or blocks after construction.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscRing() : slots(new T[Capacity]) {}
+
+    // Producer side. Returns how many items fit; the rest are not queued.
+    size_t push(const T* items, size_t count) {
+        size_t write = head.load(std::memory_order_relaxed);
+        size_t free_slots = Capacity - (write - tail.load(std::memory_order_acquire));
+        size_t n = std::min(count, free_slots);
+        for (size_t i = 0; i < n; i++) {
+            slots[(write + i) & (Capacity - 1)] = items[i];
+        }
+        head.store(write + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer side. Copies up to max items into out and returns the count.
+    size_t pop(T* out, size_t max) {
+        size_t read = tail.load(std::memory_order_relaxed);
+        size_t available = head.load(std::memory_order_acquire) - read;
+        size_t n = std::min(max, available);
+        for (size_t i = 0; i < n; i++) {
+            out[i] = slots[(read + i) & (Capacity - 1)];
+        }
+        tail.store(read + n, std::memory_order_release);
+        return n;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::unique_ptr<T[]> slots;
+};
@@ -1,20 +1,34 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
 #include <linux/input.h>
 #include <linux/uinput.h>
+#include "EventSink.hpp"
 
-class UInputDevice {
+class UInputDevice : public EventSink {
 public:
+    static constexpr const char* DEVICE_NAME = "virtual-macro-device";
+
     UInputDevice();
-    ~UInputDevice();
+    ~UInputDevice() override;
     
     bool initialize();
     void emit_event(const input_event& ev);
+    // Writes a whole frame in one syscall, appending SYN_REPORT if it is missing.
+    size_t emit_frame(const MacroEvent* events, size_t count, int64_t due_ns = 0) override;
     void destroy();
     
     bool is_initialized() const { return initialized; }
+    const std::string& device_node() const { return devnode; }
     
 private:
+    static constexpr size_t MAX_FRAME_EVENTS = 64;
+
     int fd;
     bool initialized;
+    std::string devnode;
+
+    bool setup_device();
+    bool wait_until_ready(int timeout_ms);
 };
\ No newline at end of file
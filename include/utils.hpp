@@ -1,7 +1,10 @@
 #pragma once
 
+#include <bitset>
+#include <cstdint>
 #include <string>
 #include <vector>
+#include <sys/time.h>
 #include <linux/input.h>
 
 // Filesystem compatibility
@@ -18,12 +21,48 @@ struct MacroHeader {
     int start_y;
 };
 
+// Fixed-layout event record used in memory and on disk, independent of the
+// platform's timeval size. time_us is relative to the start of recording.
+struct MacroEvent {
+    int64_t time_us;
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+};
+
+static_assert(sizeof(MacroEvent) == 16, "MacroEvent layout changed");
+
+using KeyState = std::bitset<KEY_CNT>;
+
+// Legacy files hold native input_event records, whose size follows the
+// recording machine's timeval: 24 bytes on 64-bit, 16 on 32-bit.
+struct LegacyLayout {
+    size_t record_size = 0;
+    // Left over after the last whole record, as in a truncated file.
+    size_t trailing_bytes = 0;
+};
+
 namespace utils {
     void print_devices();
+    timeval monotonic_time();
     int get_current_cursor_position(int& x, int& y);
     void set_cursor_position(int x, int y);
     int get_loop_count_from_user();
     std::vector<std::string> list_macros(const std::string& macros_dir);
-    bool read_macro_file(const std::string& filename, MacroHeader& header, std::vector<input_event>& events);
-    bool write_macro_file(const std::string& filename, const MacroHeader& header, const std::vector<input_event>& events);
+    size_t frame_length(const MacroEvent* events, size_t count);
+    size_t count_frames(const MacroEvent* events, size_t count);
+    void apply_key_events(KeyState& keys, const MacroEvent* events, size_t count);
+    void key_state_events(const KeyState& keys, int32_t value, std::vector<MacroEvent>& out);
+    uint32_t checksum(const void* data, size_t size, uint32_t previous = 0);
+    bool sync_directory(const std::string& filename);
+    // Writes filename.tmp, syncs it and renames it over filename.
+    bool write_file_atomic(const std::string& filename, const std::string& contents);
+    // Tab-separated cache files: one record per line, '#' starts a comment
+    // line. Only records with exactly field_count fields are returned.
+    std::vector<std::vector<std::string>> read_tab_records(const std::string& filename, size_t field_count);
+    bool read_macro_file(const std::string& filename, MacroHeader& header, std::vector<MacroEvent>& events);
+    bool read_legacy_macro_file(const std::string& filename, MacroHeader& header, std::vector<MacroEvent>& events,
+                                LegacyLayout* layout = nullptr);
+    bool write_macro_file(const std::string& filename, const MacroHeader& header, const std::vector<MacroEvent>& events,
+                          bool compact = false);
 }
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "Config.hpp"
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+}
+
+bool Config::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    filename = path;
+    values.clear();
+
+    std::string section;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#' || line[0] == ';') {
+            continue;
+        }
+
+        if (line.front() == '[' && line.back() == ']') {
+            section = trim(line.substr(1, line.size() - 2));
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            std::cout << path << ":" << line_number << ": ignoring malformed line" << std::endl;
+            continue;
+        }
+        values[section + "." + trim(line.substr(0, eq))] = trim(line.substr(eq + 1));
+    }
+    return true;
+}
+
+bool Config::has(const std::string& section, const std::string& key) const {
+    return values.count(section + "." + key) > 0;
+}
+
+std::string Config::get(const std::string& section, const std::string& key, const std::string& fallback) const {
+    auto it = values.find(section + "." + key);
+    return it != values.end() ? it->second : fallback;
+}
+
+int Config::get_int(const std::string& section, const std::string& key, int fallback) const {
+    std::string value = get(section, key);
+    try {
+        return value.empty() ? fallback : std::stoi(value);
+    } catch (const std::exception&) {
+        std::cout << "Invalid number for " << section << "." << key << ": " << value << std::endl;
+        return fallback;
+    }
+}
+
+bool Config::get_bool(const std::string& section, const std::string& key, bool fallback) const {
+    std::string value = get(section, key);
+    if (value == "true" || value == "yes" || value == "on" || value == "1") {
+        return true;
+    }
+    if (value == "false" || value == "no" || value == "off" || value == "0") {
+        return false;
+    }
+    return fallback;
+}
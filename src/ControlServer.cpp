@@ -0,0 +1,376 @@
+#include "ControlServer.hpp"
+#include "MacroRecorder.hpp"
+#include "Playlist.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace {
+
+const char* state_name(PlaybackState state) {
+    switch (state) {
+        case PlaybackState::Waiting: return "waiting";
+        case PlaybackState::Playing: return "playing";
+        case PlaybackState::Finished: return "finished";
+        case PlaybackState::Stopped: return "stopped";
+    }
+    return "unknown";
+}
+
+bool parse_long(const std::string& text, long& out) {
+    char* end = nullptr;
+    errno = 0;
+    out = std::strtol(text.c_str(), &end, 10);
+    return !text.empty() && *end == '\0' && errno == 0;
+}
+
+sigset_t control_signals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    return mask;
+}
+
+}
+
+ControlServer::ControlServer(MacroRecorder& recorder)
+    : recorder(recorder), listen_fd(-1), signal_fd(-1), running(false) {}
+
+ControlServer::~ControlServer() {
+    for (auto& client : clients) {
+        close(client.fd);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path.c_str());
+    }
+    if (signal_fd >= 0) {
+        close(signal_fd);
+    }
+}
+
+bool ControlServer::block_signals() {
+    sigset_t mask = control_signals();
+    if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+        std::cout << "Error blocking signals" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ControlServer::listen(const std::string& path, mode_t mode) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cout << "Control socket path too long: " << path << std::endl;
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Error creating control socket");
+        return false;
+    }
+
+    // A socket file left by a crashed daemon is replaced; a live one is not.
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+        std::cout << "Another daemon is listening on " << path << std::endl;
+        close(fd);
+        return false;
+    }
+    unlink(path.c_str());
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("Error binding control socket");
+        close(fd);
+        return false;
+    }
+    if (chmod(path.c_str(), mode) < 0 || ::listen(fd, 16) < 0) {
+        perror("Error setting up control socket");
+        close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+
+    sigset_t mask = control_signals();
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        perror("Error creating signalfd");
+    }
+
+    listen_fd = fd;
+    socket_path = path;
+    return true;
+}
+
+void ControlServer::run() {
+    if (listen_fd < 0) {
+        return;
+    }
+
+    running = true;
+    std::vector<pollfd> fds;
+    while (running) {
+        fds.clear();
+        fds.push_back({listen_fd, POLLIN, 0});
+        fds.push_back({signal_fd, POLLIN, 0});
+        for (const auto& client : clients) {
+            fds.push_back({client.fd, POLLIN, 0});
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error polling control socket");
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            signalfd_siginfo info;
+            if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                std::cout << "Received signal " << info.ssi_signo << ", shutting down" << std::endl;
+                running = false;
+            }
+        }
+
+        // Clients are served before accepting so the indexes still line up.
+        size_t kept = 0;
+        for (size_t i = 0; i < clients.size(); i++) {
+            short revents = fds[i + 2].revents;
+            if (revents == 0 || serve(clients[i])) {
+                clients[kept++] = clients[i];
+            } else {
+                close(clients[i].fd);
+            }
+        }
+        clients.resize(kept);
+
+        if (fds[0].revents & POLLIN) {
+            accept_clients();
+        }
+    }
+}
+
+void ControlServer::accept_clients() {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error accepting control client");
+            }
+            return;
+        }
+        if (clients.size() >= MAX_CLIENTS) {
+            static const char busy[] = "ERR too many clients\n";
+            send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+            close(fd);
+            continue;
+        }
+        clients.push_back({fd, std::string()});
+    }
+}
+
+// Returns false once the client is gone or misbehaved.
+bool ControlServer::serve(Client& client) {
+    char buffer[1024];
+    while (true) {
+        ssize_t n = read(client.fd, buffer, sizeof(buffer));
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            break;
+        }
+        client.input.append(buffer, n);
+    }
+
+    size_t newline;
+    while ((newline = client.input.find('\n')) != std::string::npos) {
+        std::string line = client.input.substr(0, newline);
+        client.input.erase(0, newline + 1);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        // Replies are a line each, far below the socket buffer; a client
+        // that stops reading them is dropped rather than waited for.
+        std::string reply = handle(line) + "\n";
+        if (send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(reply.size())) {
+            return false;
+        }
+    }
+
+    if (client.input.size() > MAX_LINE) {
+        static const char too_long[] = "ERR line too long\n";
+        send(client.fd, too_long, sizeof(too_long) - 1, MSG_NOSIGNAL);
+        return false;
+    }
+    return true;
+}
+
+std::string ControlServer::handle(const std::string& line) {
+    std::vector<std::string> args = Playlist::split_words(line);
+    if (args.empty()) {
+        return "ERR empty request";
+    }
+    const std::string& command = args[0];
+
+    if (command == "play") {
+        return play(args);
+    }
+    if (command == "playlist") {
+        return play_playlist(args);
+    }
+    if (command == "status") {
+        return status(args);
+    }
+    if (command == "ping") {
+        return "OK pong";
+    }
+
+    if (command == "stop" && args.size() == 2) {
+        long id;
+        if (args[1] == "all") {
+            recorder.stop_all_playback();
+            return "OK";
+        }
+        if (!parse_long(args[1], id) || id <= 0) {
+            return "ERR bad id " + args[1];
+        }
+        PlaybackStatus playback;
+        if (!recorder.playback_engine().status(id, playback)) {
+            return "ERR no playback " + args[1];
+        }
+        recorder.stop_playback(id);
+        return "OK";
+    }
+
+    if (command == "record" && args.size() == 2) {
+        if (!Playlist::valid_name(args[1])) {
+            return "ERR bad name " + args[1];
+        }
+        if (!recorder.begin_recording(args[1])) {
+            return "ERR already recording";
+        }
+        return "OK";
+    }
+
+    if (command == "stoprecord" && args.size() == 1) {
+        if (!recorder.is_recording()) {
+            return "ERR not recording";
+        }
+        recorder.stop_recording();
+        return "OK";
+    }
+
+    if (command == "preload" && args.size() == 2) {
+        if (!Playlist::valid_name(args[1]) || !recorder.preload_macro(args[1])) {
+            return "ERR cannot load " + args[1];
+        }
+        return "OK";
+    }
+
+    if (command == "list" && args.size() == 1) {
+        MacroIndex& index = recorder.macro_index();
+        index.refresh();
+        std::string reply = "OK";
+        for (const auto& info : index.query()) {
+            reply += " " + info.name;
+        }
+        return reply;
+    }
+
+    if (command == "shutdown" && args.size() == 1) {
+        running = false;
+        return "OK";
+    }
+
+    return "ERR unknown request: " + line;
+}
+
+std::string ControlServer::play(const std::vector<std::string>& args) {
+    if (args.size() < 2 || !Playlist::valid_name(args[1])) {
+        return "ERR usage: play <name> [loops=N] [offset=S] [speed=X] [delay=S] [nowarp]";
+    }
+
+    // Scripts want the macro now: no start delay and no gap before the
+    // first loop unless asked for.
+    PlaybackRequest request;
+    request.lead_in = false;
+    std::string error;
+    if (!Playlist::parse_options(args, 2, request, error)) {
+        return "ERR bad option " + error;
+    }
+
+    uint64_t id = recorder.play_macro(args[1], request);
+    if (id == 0) {
+        return "ERR cannot play " + args[1];
+    }
+    return "OK " + std::to_string(id);
+}
+
+std::string ControlServer::play_playlist(const std::vector<std::string>& args) {
+    // Only loops and delay apply to the playlist as a whole.
+    PlaybackRequest options;
+    std::string error;
+    if (args.size() < 2 || !Playlist::valid_name(args[1])) {
+        return "ERR usage: playlist <name> [loops=N] [delay=S]";
+    }
+    if (!Playlist::parse_options(args, 2, options, error) || options.start_offset_us != 0 ||
+        options.speed != 1.0 || !options.warp_cursor) {
+        return "ERR bad option " + (error.empty() ? args.back() : error);
+    }
+
+    uint64_t id = recorder.play_playlist(args[1], options.loop_count, options.delay_us);
+    if (id == 0) {
+        return "ERR cannot play " + args[1];
+    }
+    return "OK " + std::to_string(id);
+}
+
+std::string ControlServer::status(const std::vector<std::string>& args) {
+    const PlaybackEngine& engine = recorder.playback_engine();
+    if (args.size() == 1) {
+        return "OK recording=" + std::to_string(recorder.is_recording() ? 1 : 0) +
+               " events=" + std::to_string(recorder.recorded_event_count()) +
+               " playing=" + std::to_string(engine.active_count()) +
+               " cache_hits=" + std::to_string(recorder.macro_cache().hits()) +
+               " cache_misses=" + std::to_string(recorder.macro_cache().misses());
+    }
+
+    long id;
+    PlaybackStatus playback;
+    if (args.size() != 2 || !parse_long(args[1], id) || id <= 0) {
+        return "ERR usage: status [id]";
+    }
+    if (!engine.status(id, playback)) {
+        return "ERR no playback " + args[1];
+    }
+
+    std::string loops = playback.loop_count == -1 ? "inf" : std::to_string(playback.loop_count);
+    std::string reply = "OK " + std::to_string(playback.id) + " " + playback.name + " " + state_name(playback.state) +
+                        " loop=" + std::to_string(playback.current_loop) + "/" + loops +
+                        " frames=" + std::to_string(playback.frames_emitted);
+    if (!playback.sequence.empty()) {
+        reply += " playlist=" + playback.sequence + " entry=" + std::to_string(playback.segment);
+    }
+    return reply;
+}
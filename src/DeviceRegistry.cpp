@@ -0,0 +1,413 @@
+#include "DeviceRegistry.hpp"
+#include "UInputDevice.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+namespace {
+
+constexpr size_t LONG_BITS = sizeof(unsigned long) * CHAR_BIT;
+
+bool test_bit(const unsigned long* bits, int bit) {
+    return bits[bit / LONG_BITS] & (1UL << (bit % LONG_BITS));
+}
+
+// Keeps the tab-separated cache parseable.
+std::string clean(const char* text) {
+    std::string value = text;
+    std::replace_if(value.begin(), value.end(), [](char c) { return c == '\t' || c == '\n'; }, ' ');
+    return value;
+}
+
+bool is_event_node(const std::string& name) {
+    return name.compare(0, 5, "event") == 0;
+}
+
+int event_number(const std::string& path) {
+    size_t pos = path.rfind("event");
+    return pos == std::string::npos ? INT_MAX : std::atoi(path.c_str() + pos + 5);
+}
+
+bool same_node(const InputDeviceInfo& a, const InputDeviceInfo& b) {
+    return a.rdev == b.rdev && a.ctime.tv_sec == b.ctime.tv_sec && a.ctime.tv_nsec == b.ctime.tv_nsec;
+}
+
+std::string capability_names(unsigned int capabilities) {
+    std::string names;
+    if (capabilities & DEVICE_POINTER) {
+        names += " pointer";
+    }
+    if (capabilities & DEVICE_KEYBOARD) {
+        names += " keyboard";
+    }
+    return names.empty() ? " other" : names;
+}
+
+}
+
+std::string InputDeviceInfo::key() const {
+    char ids[32];
+    snprintf(ids, sizeof(ids), "%04x:%04x:%04x", id.bustype, id.vendor, id.product);
+    return std::string(ids) + "/" + phys;
+}
+
+DeviceRegistry::DeviceRegistry() : watching(false), change_count(0), probes(0), inotify_fd(-1) {}
+
+DeviceRegistry::~DeviceRegistry() {
+    stop_watching();
+}
+
+bool DeviceRegistry::probe(const std::string& path, InputDeviceInfo& info) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1 || !S_ISCHR(st.st_mode)) {
+        return false;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    info = InputDeviceInfo();
+    info.path = path;
+    info.rdev = st.st_rdev;
+    info.ctime = st.st_ctim;
+
+    char text[256] = {0};
+    if (ioctl(fd, EVIOCGNAME(sizeof(text) - 1), text) >= 0) {
+        info.name = clean(text);
+    }
+    memset(text, 0, sizeof(text));
+    if (ioctl(fd, EVIOCGPHYS(sizeof(text) - 1), text) >= 0) {
+        info.phys = clean(text);
+    }
+    ioctl(fd, EVIOCGID, &info.id);
+
+    unsigned long ev_bits[EV_MAX / LONG_BITS + 1] = {0};
+    unsigned long rel_bits[REL_MAX / LONG_BITS + 1] = {0};
+    unsigned long key_bits[KEY_MAX / LONG_BITS + 1] = {0};
+    ioctl(fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
+    if (test_bit(ev_bits, EV_REL)) {
+        ioctl(fd, EVIOCGBIT(EV_REL, sizeof(rel_bits)), rel_bits);
+    }
+    if (test_bit(ev_bits, EV_KEY)) {
+        ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits);
+    }
+    close(fd);
+
+    if (test_bit(rel_bits, REL_X) && test_bit(rel_bits, REL_Y) && test_bit(key_bits, BTN_LEFT)) {
+        info.capabilities |= DEVICE_POINTER;
+    }
+
+    // Media remotes and power buttons report EV_KEY too; a keyboard needs
+    // the letters and the keys the hotkeys rely on.
+    static const int keyboard_keys[] = {KEY_ESC, KEY_A, KEY_Z, KEY_SPACE, KEY_ENTER, KEY_F9};
+    bool keyboard = true;
+    for (int code : keyboard_keys) {
+        keyboard = keyboard && test_bit(key_bits, code);
+    }
+    if (keyboard) {
+        info.capabilities |= DEVICE_KEYBOARD;
+    }
+
+    // Never record from our own playback device.
+    if (info.name == UInputDevice::DEVICE_NAME) {
+        info.capabilities = 0;
+    }
+    return true;
+}
+
+size_t DeviceRegistry::scan(const std::string& directory) {
+    std::map<std::string, InputDeviceInfo> cached = load_cache();
+    std::map<std::string, InputDeviceInfo> found;
+
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(directory, ec)) {
+        std::string name = entry.path().filename().string();
+        if (!is_event_node(name)) {
+            continue;
+        }
+
+        std::string path = entry.path().string();
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1) {
+            continue;
+        }
+
+        auto it = cached.find(path);
+        if (it != cached.end() && it->second.rdev == st.st_rdev &&
+            it->second.ctime.tv_sec == st.st_ctim.tv_sec && it->second.ctime.tv_nsec == st.st_ctim.tv_nsec) {
+            found[path] = it->second;
+            continue;
+        }
+
+        InputDeviceInfo info;
+        probes++;
+        if (probe(path, info)) {
+            found[path] = info;
+        }
+    }
+    if (ec) {
+        std::cout << "Error scanning " << directory << ": " << ec.message() << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    dir = directory;
+    known = std::move(found);
+    save_cache();
+    return known.size();
+}
+
+bool DeviceRegistry::start_watching() {
+    if (watching) {
+        return true;
+    }
+    if (dir.empty()) {
+        dir = "/dev/input";
+    }
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("Error creating inotify instance");
+        return false;
+    }
+    // Permissions are applied by udev after the node appears, so IN_ATTRIB
+    // retries a probe that failed on IN_CREATE.
+    if (inotify_add_watch(inotify_fd, dir.c_str(), IN_CREATE | IN_DELETE | IN_ATTRIB) == -1) {
+        perror(("Error watching " + dir).c_str());
+        close(inotify_fd);
+        inotify_fd = -1;
+        return false;
+    }
+
+    watching = true;
+    watcher = std::thread(&DeviceRegistry::watch_loop, this);
+    return true;
+}
+
+void DeviceRegistry::stop_watching() {
+    watching = false;
+    if (watcher.joinable()) {
+        watcher.join();
+    }
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+}
+
+void DeviceRegistry::watch_loop() {
+    alignas(inotify_event) char buffer[4096];
+    pollfd pfd{inotify_fd, POLLIN, 0};
+
+    while (watching) {
+        if (::poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+
+        ssize_t bytes = read(inotify_fd, buffer, sizeof(buffer));
+        for (ssize_t offset = 0; offset < bytes;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            if (event->len == 0 || !is_event_node(event->name)) {
+                continue;
+            }
+
+            std::string path = dir + "/" + event->name;
+            if (event->mask & IN_DELETE) {
+                handle_removed(path);
+            } else {
+                handle_added(path);
+            }
+        }
+    }
+}
+
+void DeviceRegistry::handle_added(const std::string& path) {
+    InputDeviceInfo info;
+    probes++;
+    if (!probe(path, info)) {
+        return;
+    }
+
+    std::function<void(const InputDeviceInfo&, bool)> callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = known.find(path);
+        if (it != known.end() && same_node(it->second, info)) {
+            return;
+        }
+        known[path] = info;
+        save_cache();
+        callback = on_change;
+    }
+
+    change_count++;
+    if (callback) {
+        callback(info, true);
+    }
+}
+
+void DeviceRegistry::handle_removed(const std::string& path) {
+    InputDeviceInfo info;
+    std::function<void(const InputDeviceInfo&, bool)> callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = known.find(path);
+        if (it == known.end()) {
+            return;
+        }
+        info = it->second;
+        known.erase(it);
+        save_cache();
+        callback = on_change;
+    }
+
+    change_count++;
+    if (callback) {
+        callback(info, false);
+    }
+}
+
+bool DeviceRegistry::resolve(const std::string& spec, unsigned int capability, std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (spec.empty() || spec == "auto") {
+        // Prefer a device that is only what we asked for, then a physical one.
+        const InputDeviceInfo* best = nullptr;
+        int best_score = -1;
+        for (const auto& entry : known) {
+            const InputDeviceInfo& info = entry.second;
+            if (!(info.capabilities & capability)) {
+                continue;
+            }
+            int score = (info.capabilities == capability ? 2 : 0) + (info.phys.empty() ? 0 : 1);
+            if (score > best_score ||
+                (score == best_score && event_number(info.path) < event_number(best->path))) {
+                best = &info;
+                best_score = score;
+            }
+        }
+        if (!best) {
+            return false;
+        }
+        path = best->path;
+        return true;
+    }
+
+    if (spec[0] == '/') {
+        auto it = known.find(spec);
+        auto pin = pins.find(spec);
+        if (it != known.end() && (pin == pins.end() || pin->second == it->second.key())) {
+            pins[spec] = it->second.key();
+            path = spec;
+            return true;
+        }
+        if (pin != pins.end()) {
+            for (const auto& entry : known) {
+                if (entry.second.key() == pin->second) {
+                    path = entry.first;
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Not probed (no permission yet?); let the caller's open() report it.
+        path = spec;
+        return fs::exists(spec);
+    }
+
+    for (const auto& entry : known) {
+        if (entry.second.key() == spec || entry.second.name == spec) {
+            path = entry.first;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<InputDeviceInfo> DeviceRegistry::devices() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<InputDeviceInfo> result;
+    for (const auto& entry : known) {
+        result.push_back(entry.second);
+    }
+    std::sort(result.begin(), result.end(), [](const InputDeviceInfo& a, const InputDeviceInfo& b) {
+        return event_number(a.path) < event_number(b.path);
+    });
+    return result;
+}
+
+void DeviceRegistry::set_change_callback(std::function<void(const InputDeviceInfo&, bool)> callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    on_change = callback;
+}
+
+void DeviceRegistry::print() const {
+    std::cout << "Available devices:" << std::endl;
+    for (const auto& info : devices()) {
+        std::cout << info.path << ": " << info.name << " [" << info.key() << "]"
+                  << capability_names(info.capabilities);
+        if (access(info.path.c_str(), R_OK) != 0) {
+            std::cout << " (NO READ ACCESS)";
+        }
+        std::cout << std::endl;
+    }
+}
+
+std::map<std::string, InputDeviceInfo> DeviceRegistry::load_cache() const {
+    std::map<std::string, InputDeviceInfo> cached;
+    if (cache_file.empty()) {
+        return cached;
+    }
+
+    for (const auto& fields : utils::read_tab_records(cache_file, 11)) {
+        try {
+            InputDeviceInfo info;
+            info.path = fields[0];
+            info.rdev = static_cast<dev_t>(std::stoull(fields[1]));
+            info.ctime.tv_sec = static_cast<time_t>(std::stoll(fields[2]));
+            info.ctime.tv_nsec = std::stol(fields[3]);
+            info.id.bustype = static_cast<uint16_t>(std::stoul(fields[4], nullptr, 16));
+            info.id.vendor = static_cast<uint16_t>(std::stoul(fields[5], nullptr, 16));
+            info.id.product = static_cast<uint16_t>(std::stoul(fields[6], nullptr, 16));
+            info.id.version = static_cast<uint16_t>(std::stoul(fields[7], nullptr, 16));
+            info.capabilities = static_cast<unsigned int>(std::stoul(fields[8]));
+            info.phys = fields[9];
+            info.name = fields[10];
+            cached[info.path] = info;
+        } catch (const std::exception&) {
+            continue;
+        }
+    }
+    return cached;
+}
+
+void DeviceRegistry::save_cache() const {
+    if (cache_file.empty()) {
+        return;
+    }
+
+    std::ostringstream file;
+    file << "# macrowise device cache v1\n";
+    for (const auto& entry : known) {
+        const InputDeviceInfo& info = entry.second;
+        file << info.path << '\t' << info.rdev << '\t' << info.ctime.tv_sec << '\t' << info.ctime.tv_nsec
+             << std::hex << '\t' << info.id.bustype << '\t' << info.id.vendor << '\t' << info.id.product
+             << '\t' << info.id.version << std::dec << '\t' << info.capabilities << '\t' << info.phys
+             << '\t' << info.name << '\n';
+    }
+    if (!utils::write_file_atomic(cache_file, file.str())) {
+        perror(("Error writing " + cache_file).c_str());
+    }
+}
@@ -0,0 +1,352 @@
+#include "InputMultiplexer.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+namespace {
+
+bool event_before(const input_event& a, const input_event& b) {
+    return timercmp(&a.time, &b.time, <);
+}
+
+void apply_keys(KeyState& keys, const input_event* events, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const input_event& ev = events[i];
+        if (ev.type == EV_KEY && ev.code < KEY_CNT && ev.value != 2) {
+            keys.set(ev.code, ev.value != 0);
+        }
+    }
+}
+
+}
+
+InputMultiplexer::InputMultiplexer()
+    : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      drops(0), grab_enabled(false) {
+    if (epoll_fd == -1) {
+        perror("Error creating epoll instance");
+        return;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u32 = WAKE_INDEX;
+    if (wake_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1) {
+        perror("Error registering wake-up eventfd");
+    }
+}
+
+InputMultiplexer::~InputMultiplexer() {
+    close_all();
+    if (wake_fd != -1) {
+        close(wake_fd);
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+}
+
+void InputMultiplexer::wake() {
+    uint64_t one = 1;
+    if (wake_fd != -1 && write(wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        perror("Error waking input poll");
+    }
+}
+
+size_t InputMultiplexer::device_count() const {
+    size_t count = 0;
+    for (const auto& device : devices) {
+        count += device.fd != -1;
+    }
+    return count;
+}
+
+bool InputMultiplexer::add_device(const std::string& path, unsigned int type_mask,
+                                  const std::vector<uint16_t>& key_codes) {
+    if (epoll_fd == -1) {
+        return false;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        perror(("Error opening input device " + path).c_str());
+        return false;
+    }
+
+    int clock_id = CLOCK_MONOTONIC;
+    if (ioctl(fd, EVIOCSCLOCKID, &clock_id) == -1) {
+        perror(("Warning: cannot switch " + path + " to monotonic timestamps").c_str());
+    }
+
+    // Closed slots are reused so the epoll index stays small.
+    size_t slot = 0;
+    while (slot < devices.size() && devices[slot].fd != -1) {
+        slot++;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u32 = static_cast<uint32_t>(slot);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("Error registering input device");
+        close(fd);
+        return false;
+    }
+
+    Device device{path, fd, type_mask, false, KeyState(), KeyState(), false};
+    set_key_filter(device, key_codes);
+    install_mask(device);
+    if (grab_enabled && ioctl(fd, EVIOCGRAB, 1) == -1) {
+        perror(("Warning: cannot grab " + path).c_str());
+    }
+
+    // Start from the real key state so the first resync has a baseline.
+    unsigned char bits[KEY_MAX / 8 + 1] = {};
+    if (ioctl(fd, EVIOCGKEY(sizeof(bits)), bits) != -1) {
+        for (int code = 0; code < KEY_CNT; code++) {
+            device.keys.set(code, bits[code / 8] & (1 << (code % 8)));
+        }
+    }
+    devices.push_back(device);
+    return true;
+}
+
+bool InputMultiplexer::set_filter(const std::string& path, unsigned int type_mask,
+                                  const std::vector<uint16_t>& key_codes) {
+    for (auto& device : devices) {
+        if (device.fd != -1 && device.path == path) {
+            device.type_mask = type_mask;
+            set_key_filter(device, key_codes);
+            install_mask(device);
+            return true;
+        }
+    }
+    return false;
+}
+
+void InputMultiplexer::close_device(const std::string& path) {
+    for (auto& device : devices) {
+        if (device.fd != -1 && device.path == path) {
+            remove_device(device);
+        }
+    }
+}
+
+void InputMultiplexer::set_key_filter(Device& device, const std::vector<uint16_t>& key_codes) {
+    device.filter_keys = !key_codes.empty();
+    device.key_filter.reset();
+    for (uint16_t code : key_codes) {
+        if (code < KEY_CNT) {
+            device.key_filter.set(code);
+        }
+    }
+}
+
+void InputMultiplexer::install_mask(const Device& device) {
+    // EV_SYN is never filtered by the kernel, so SYN_DROPPED still arrives.
+    // Kernels before 4.4 reject EVIOCSMASK; the checks in drain() cover them.
+    // Filters can be widened later, so an "everything" mask is installed
+    // too rather than skipped.
+    unsigned char types[EV_CNT / 8 + 1] = {0};
+    for (int type = 0; type < EV_CNT; type++) {
+        if (device.type_mask & (1u << type)) {
+            types[type / 8] |= 1 << (type % 8);
+        }
+    }
+    input_mask type_mask{0, sizeof(types), reinterpret_cast<uint64_t>(types)};
+    ioctl(device.fd, EVIOCSMASK, &type_mask);
+
+    unsigned char codes[KEY_CNT / 8 + 1] = {0};
+    for (int code = 0; code < KEY_CNT; code++) {
+        if (!device.filter_keys || device.key_filter.test(code)) {
+            codes[code / 8] |= 1 << (code % 8);
+        }
+    }
+    input_mask key_mask{EV_KEY, sizeof(codes), reinterpret_cast<uint64_t>(codes)};
+    ioctl(device.fd, EVIOCSMASK, &key_mask);
+}
+
+bool InputMultiplexer::set_grab(bool grab) {
+    bool ok = true;
+    for (const auto& device : devices) {
+        if (device.fd != -1 && ioctl(device.fd, EVIOCGRAB, grab ? 1 : 0) == -1) {
+            perror(("Error " + std::string(grab ? "grabbing " : "releasing ") + device.path).c_str());
+            ok = false;
+        }
+    }
+    grab_enabled = grab;
+    return ok;
+}
+
+bool InputMultiplexer::any_key_down() const {
+    for (const auto& device : devices) {
+        unsigned char bits[KEY_MAX / 8 + 1] = {};
+        if (device.fd == -1 || ioctl(device.fd, EVIOCGKEY(sizeof(bits)), bits) == -1) {
+            continue;
+        }
+        for (unsigned char byte : bits) {
+            if (byte != 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void InputMultiplexer::close_all() {
+    for (auto& device : devices) {
+        remove_device(device);
+    }
+    devices.clear();
+}
+
+bool InputMultiplexer::is_open(const std::string& path) const {
+    for (const auto& device : devices) {
+        if (device.fd != -1 && device.path == path) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int InputMultiplexer::poll(std::vector<input_event>& out, int timeout_ms) {
+    epoll_event ready[MAX_READY];
+    int n = epoll_wait(epoll_fd, ready, MAX_READY, timeout_ms);
+    if (n == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    size_t first = out.size();
+    for (int i = 0; i < n; i++) {
+        uint32_t index = ready[i].data.u32;
+        if (index == WAKE_INDEX) {
+            uint64_t value;
+            ssize_t ignored = read(wake_fd, &value, sizeof(value));
+            (void)ignored;
+            continue;
+        }
+        if (index >= devices.size() || devices[index].fd == -1) {
+            continue;
+        }
+
+        size_t chunk_start = out.size();
+        drain(devices[index], out);
+
+        // Each device stream is already in kernel order, so a stable merge
+        // keeps its frames contiguous while interleaving devices by time.
+        std::inplace_merge(out.begin() + first, out.begin() + chunk_start, out.end(), event_before);
+    }
+
+    return static_cast<int>(out.size() - first);
+}
+
+size_t InputMultiplexer::drain(Device& device, std::vector<input_event>& out) {
+    size_t first = out.size();
+    // Start of the frame still being assembled. A frame that began in an
+    // earlier drain has already been handed out and cannot be taken back.
+    size_t frame_start = first;
+
+    while (true) {
+        ssize_t bytes = read(device.fd, buffer, sizeof(buffer));
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                std::cout << "Input device " << device.path << " lost: " << strerror(errno) << std::endl;
+                remove_device(device);
+            }
+            break;
+        }
+
+        size_t count = static_cast<size_t>(bytes) / sizeof(input_event);
+        for (size_t i = 0; i < count; i++) {
+            const input_event& ev = buffer[i];
+            bool report = ev.type == EV_SYN && ev.code == SYN_REPORT;
+
+            if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+                out.resize(frame_start);
+                device.dropping = true;
+                drops++;
+                continue;
+            }
+            if (device.dropping) {
+                if (report) {
+                    device.dropping = false;
+                    resync(device, ev.time, out);
+                    frame_start = out.size();
+                }
+                continue;
+            }
+
+            bool wanted = device.type_mask & (1u << ev.type);
+            if (wanted && ev.type == EV_KEY && device.filter_keys) {
+                wanted = ev.code < KEY_CNT && device.key_filter.test(ev.code);
+            }
+            if (wanted) {
+                out.push_back(ev);
+            }
+            if (report) {
+                apply_keys(device.keys, out.data() + frame_start, out.size() - frame_start);
+                frame_start = out.size();
+            }
+        }
+
+        if (count < READ_BATCH) {
+            break;
+        }
+    }
+
+    apply_keys(device.keys, out.data() + frame_start, out.size() - frame_start);
+    return out.size() - first;
+}
+
+void InputMultiplexer::resync(Device& device, const timeval& time, std::vector<input_event>& out) {
+    unsigned char bits[KEY_MAX / 8 + 1] = {};
+    if (device.fd == -1 || ioctl(device.fd, EVIOCGKEY(sizeof(bits)), bits) == -1) {
+        return;
+    }
+
+    bool keep_keys = device.type_mask & (1u << EV_KEY);
+    bool changed = false;
+    for (int code = 0; code < KEY_CNT; code++) {
+        bool down = bits[code / 8] & (1 << (code % 8));
+        if (device.keys.test(code) == down) {
+            continue;
+        }
+        device.keys.set(code, down);
+        if (keep_keys && (!device.filter_keys || device.key_filter.test(code))) {
+            input_event ev{};
+            ev.time = time;
+            ev.type = EV_KEY;
+            ev.code = static_cast<uint16_t>(code);
+            ev.value = down ? 1 : 0;
+            out.push_back(ev);
+            changed = true;
+        }
+    }
+
+    if (changed && (device.type_mask & (1u << EV_SYN))) {
+        input_event syn{};
+        syn.time = time;
+        syn.type = EV_SYN;
+        syn.code = SYN_REPORT;
+        out.push_back(syn);
+    }
+}
+
+void InputMultiplexer::remove_device(Device& device) {
+    if (device.fd != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, device.fd, nullptr);
+        close(device.fd);
+        device.fd = -1;
+    }
+}
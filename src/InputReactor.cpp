@@ -0,0 +1,271 @@
+#include "InputReactor.hpp"
+#include "DeviceRegistry.hpp"
+#include "utils.hpp"
+#include <iostream>
+
+InputReactor::InputReactor()
+    : registry(nullptr), next_id(1), sync_requested(0), sync_done(0), grab_holds(0), dirty(false), replugged(false), running(false), drops(0) {}
+
+InputReactor::~InputReactor() {
+    stop();
+    if (registry) {
+        registry->set_change_callback(nullptr);
+    }
+}
+
+void InputReactor::set_device_registry(DeviceRegistry* devices) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        registry = devices;
+    }
+    if (devices) {
+        devices->set_change_callback([this](const InputDeviceInfo&, bool) {
+            refresh();
+        });
+    }
+}
+
+bool InputReactor::resolve(const std::string& spec, unsigned int capability, std::string& path) {
+    if (!registry) {
+        path = spec;
+        return fs::exists(spec);
+    }
+    return registry->resolve(spec, capability, path);
+}
+
+uint64_t InputReactor::acquire(const std::string& spec, unsigned int capability, unsigned int type_mask,
+                               const std::vector<uint16_t>& key_codes) {
+    std::string path;
+    if (!resolve(spec, capability, path)) {
+        std::cout << "No input device matches '" << spec << "'" << std::endl;
+        return 0;
+    }
+
+    uint64_t id;
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        id = next_id++;
+        acquisitions[id] = {spec, capability, type_mask, key_codes};
+        ticket = ++sync_requested;
+        dirty = true;
+    }
+    ensure_running();
+    input.wake();
+
+    // The open itself happens on the reactor thread; wait for its outcome
+    // so callers do not carry on without a readable device.
+    std::unique_lock<std::mutex> lock(mutex);
+    synced.wait(lock, [&]() {
+        return sync_done >= ticket || !running;
+    });
+    if (open_paths.count(path) == 0) {
+        std::cout << "Cannot open input device " << path << std::endl;
+        acquisitions.erase(id);
+        dirty = true;
+        input.wake();
+        return 0;
+    }
+    return id;
+}
+
+void InputReactor::release(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (acquisitions.erase(id) > 0) {
+        dirty = true;
+        input.wake();
+    }
+}
+
+uint64_t InputReactor::subscribe(Subscriber callback) {
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        id = next_id++;
+        subscribers[id] = std::make_shared<Subscriber>(std::move(callback));
+    }
+    ensure_running();
+    return id;
+}
+
+void InputReactor::unsubscribe(uint64_t id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        subscribers.erase(id);
+    }
+    if (std::this_thread::get_id() != worker.get_id()) {
+        std::lock_guard<std::mutex> wait(dispatch_mutex);
+    }
+}
+
+void InputReactor::hold_grab() {
+    std::lock_guard<std::mutex> lock(mutex);
+    grab_holds++;
+    input.wake();
+}
+
+void InputReactor::release_grab() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (grab_holds > 0) {
+        grab_holds--;
+    }
+    input.wake();
+}
+
+void InputReactor::refresh() {
+    std::lock_guard<std::mutex> lock(mutex);
+    dirty = true;
+    replugged = true;
+    input.wake();
+}
+
+void InputReactor::ensure_running() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running) {
+        running = true;
+        worker = std::thread(&InputReactor::run, this);
+    }
+}
+
+void InputReactor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    synced.notify_all();
+    input.wake();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void InputReactor::run() {
+    utils::enter_realtime(realtime);
+
+    std::vector<input_event> events;
+    events.reserve(1024);
+    std::vector<std::shared_ptr<Subscriber>> targets;
+
+    while (true) {
+        bool resync;
+        bool report;
+        bool want_grab;
+        uint64_t ticket;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) {
+                break;
+            }
+            ticket = sync_requested;
+            resync = dirty;
+            report = replugged;
+            dirty = false;
+            replugged = false;
+            want_grab = grab_holds > 0;
+        }
+
+        if (resync) {
+            sync_devices(report);
+            std::lock_guard<std::mutex> lock(mutex);
+            open_paths.clear();
+            for (const auto& entry : opened) {
+                open_paths.insert(entry.first);
+            }
+            sync_done = ticket;
+            synced.notify_all();
+        }
+        if (want_grab != input.grabbed() && (!want_grab || !input.any_key_down())) {
+            input.set_grab(want_grab);
+        }
+
+        // A pending grab is retried shortly; otherwise sleep until input
+        // arrives or someone calls wake().
+        events.clear();
+        int n = input.poll(events, want_grab != input.grabbed() ? 10 : -1);
+        drops = input.drop_count();
+        if (n <= 0) {
+            continue;
+        }
+
+        targets.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& entry : subscribers) {
+                targets.push_back(entry.second);
+            }
+        }
+
+        std::lock_guard<std::mutex> dispatching(dispatch_mutex);
+        for (const auto& target : targets) {
+            (*target)(events.data(), events.size());
+        }
+    }
+
+    input.set_grab(false);
+    input.close_all();
+    opened.clear();
+}
+
+void InputReactor::sync_devices(bool report) {
+    std::vector<Acquisition> wanted_list;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& entry : acquisitions) {
+            wanted_list.push_back(entry.second);
+        }
+    }
+
+    std::map<std::string, Filter> wanted;
+    for (const auto& acquisition : wanted_list) {
+        std::string path;
+        if (!resolve(acquisition.spec, acquisition.capability, path)) {
+            continue;
+        }
+
+        Filter& filter = wanted[path];
+        filter.type_mask |= acquisition.type_mask;
+        if (acquisition.type_mask & (1u << EV_KEY)) {
+            if (acquisition.key_codes.empty()) {
+                filter.all_keys = true;
+            }
+            filter.key_codes.insert(acquisition.key_codes.begin(), acquisition.key_codes.end());
+        }
+    }
+
+    for (auto it = opened.begin(); it != opened.end();) {
+        if (wanted.count(it->first) == 0) {
+            input.close_device(it->first);
+            it = opened.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (const auto& entry : wanted) {
+        const std::string& path = entry.first;
+        const Filter& filter = entry.second;
+        std::vector<uint16_t> codes;
+        if (!filter.all_keys) {
+            codes.assign(filter.key_codes.begin(), filter.key_codes.end());
+        }
+
+        if (input.is_open(path)) {
+            auto it = opened.find(path);
+            if (it == opened.end() || !(it->second == filter)) {
+                input.set_filter(path, filter.type_mask, codes);
+                opened[path] = filter;
+            }
+            continue;
+        }
+
+        // A device that vanished is opened again here under its new node.
+        if (input.add_device(path, filter.type_mask, codes)) {
+            opened[path] = filter;
+            if (report) {
+                std::cout << "Input device attached: " << path << std::endl;
+            }
+        } else {
+            opened.erase(path);
+        }
+    }
+}
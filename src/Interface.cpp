@@ -1,13 +1,50 @@
 #include "Interface.hpp"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
 #include <iostream>
-#include <thread>
-#include <chrono>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
-Interface::Interface() {
+namespace {
+
+int64_t now_ms() {
+    return PlaybackScheduler::now_ns() / 1000000;
+}
+
+const char* state_name(PlaybackState state) {
+    switch (state) {
+        case PlaybackState::Waiting: return "Waiting";
+        case PlaybackState::Playing: return "Playing";
+        case PlaybackState::Finished: return "Finished";
+        case PlaybackState::Stopped: return "Stopped";
+    }
+    return "";
+}
+
+std::string format(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+std::string format(const char* fmt, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    return buffer;
+}
+
+}
+
+Interface::Interface()
+    : wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), wake_pending(false), exit_requested(false), dirty(false), last_draw_ms(0) {
     initscr();
     cbreak();
     noecho();
     keypad(stdscr, TRUE);
+    // Keys are read only after poll() reports stdin ready.
+    nodelay(stdscr, TRUE);
     curs_set(0);
     
     init_colors();
@@ -24,6 +61,72 @@ Interface::~Interface() {
     delwin(main_win);
     delwin(status_win);
     endwin();
+    if (wake_fd != -1) {
+        close(wake_fd);
+    }
+}
+
+void Interface::notify() {
+    if (wake_fd != -1 && !wake_pending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+void Interface::request_exit() {
+    exit_requested = true;
+    if (wake_fd != -1) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+int Interface::wait_key(int timeout_ms, bool watch_updates) {
+    // curses may already hold typed-ahead bytes that poll() cannot see.
+    int ch = getch();
+    if (ch != ERR) {
+        return ch;
+    }
+
+    pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    int count = watch_updates && wake_fd != -1 ? 2 : 1;
+    if (::poll(fds, count, timeout_ms) <= 0) {
+        return ERR;
+    }
+
+    if (count == 2 && (fds[1].revents & POLLIN)) {
+        uint64_t value;
+        ssize_t ignored = read(wake_fd, &value, sizeof(value));
+        (void)ignored;
+        dirty = true;
+    }
+    return (fds[0].revents & POLLIN) ? getch() : ERR;
+}
+
+int Interface::wait_for_key() {
+    int ch;
+    while ((ch = wait_key(-1, true)) == ERR && !exit_requested) {
+    }
+    return ch;
+}
+
+int Interface::next_event(bool& redraw, int idle_ms) {
+    // Once something changed, stop listening for updates until the next
+    // frame slot; a burst of notifications then costs a single repaint.
+    int64_t now = now_ms();
+    int64_t wait = dirty ? last_draw_ms + FRAME_MS - now : last_draw_ms + idle_ms - now;
+    int ch = wait_key(static_cast<int>(std::max<int64_t>(wait, 0)), !dirty);
+
+    now = now_ms();
+    redraw = (dirty && now - last_draw_ms >= FRAME_MS) || now - last_draw_ms >= idle_ms;
+    if (redraw) {
+        dirty = false;
+        last_draw_ms = now;
+        wake_pending = false;
+    }
+    return ch;
 }
 
 void Interface::init_colors() {
@@ -49,17 +152,39 @@ void Interface::draw_border() {
 }
 
 void Interface::clear_status() {
-    wclear(status_win);
+    werase(status_win);
+    status_text.clear();
     draw_border();
     wrefresh(status_win);
 }
 
 void Interface::update_status(const std::string& message) {
-    clear_status();
-    mvwprintw(status_win, 1, 2, "%s", message.c_str());
+    if (message == status_text) {
+        return;
+    }
+    status_text = message;
+
+    // Pad over the previous text instead of erasing, so the box stays put.
+    int width = std::max(COLS - 4, 0);
+    mvwprintw(status_win, 1, 2, "%-*.*s", width, width, message.c_str());
     wrefresh(status_win);
 }
 
+void Interface::clear_screen() {
+    werase(main_win);
+    fields.clear();
+}
+
+void Interface::set_field(int row, const std::string& text) {
+    auto it = fields.find(row);
+    if (it != fields.end() && it->second == text) {
+        return;
+    }
+    fields[row] = text;
+    mvwprintw(main_win, row, 5, "%s", text.c_str());
+    wclrtoeol(main_win);
+}
+
 std::string Interface::get_input(const std::string& prompt) {
     echo();
     curs_set(1);
@@ -88,13 +213,22 @@ int Interface::get_number_input(const std::string& prompt) {
     }
 }
 
+double Interface::get_decimal_input(const std::string& prompt, double fallback) {
+    std::string input = get_input(prompt);
+    try {
+        return input.empty() ? fallback : std::stod(input);
+    } catch (...) {
+        return fallback;
+    }
+}
+
 void Interface::run() {
     int choice;
     bool running = true;
     
-    while (running) {
+    while (running && !exit_requested) {
         show_menu();
-        choice = getch();
+        choice = wait_for_key();
         
         switch (choice) {
             case '1': {
@@ -104,18 +238,7 @@ void Interface::run() {
                     if (recording_callback) {
                         recording_callback(name);
                     }
-                    
-                    // Wait for recording to complete
-                    timeout(100);
-                    while (recording_status_callback && recording_status_callback()) {
-                        int ch = getch();
-                        if (ch != ERR) {
-                            // Handle any key press if needed
-                        }
-                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                    }
-                    timeout(-1);
-                    
+                    watch_recording();
                     show_message("Recording finished");
                 }
                 break;
@@ -124,21 +247,47 @@ void Interface::run() {
                 std::string name = get_input("Enter macro name to play: ");
                 if (!name.empty()) {
                     int loops = get_number_input("Enter number of loops (0 for infinite): ");
+                    double start_at = get_decimal_input("Start at second (blank for 0): ", 0.0);
+                    double speed = get_decimal_input("Speed factor (blank for 1.0): ", 1.0);
                     show_playback_screen(name, loops);
                     if (playback_callback) {
-                        playback_callback(name, loops);
+                        uint64_t id = playback_callback(name, loops, start_at, speed);
+                        if (id != 0) {
+                            watch_playback(id);
+                        } else {
+                            show_error("Could not start playback of " + name);
+                        }
                     }
                 }
                 break;
             }
             case '3': {
-                if (list_callback) {
-                    std::vector<std::string> macros = list_callback();
-                    show_macros_list(macros);
+                show_macros_list();
+                break;
+            }
+            case '4': {
+                std::string name = get_input("Enter macro name to optimize: ");
+                if (!name.empty() && optimize_callback) {
+                    show_message(optimize_callback(name));
+                    wait_for_key();
                 }
                 break;
             }
-            case '4':
+            case '5': {
+                std::string name = get_input("Enter playlist name: ");
+                if (!name.empty() && playlist_callback) {
+                    int loops = get_number_input("Enter number of passes (0 for infinite): ");
+                    show_playback_screen(name, loops);
+                    uint64_t id = playlist_callback(name, loops);
+                    if (id != 0) {
+                        watch_playback(id);
+                    } else {
+                        show_error("Could not start playlist " + name);
+                    }
+                }
+                break;
+            }
+            case '6':
                 running = false;
                 break;
             case 'q':
@@ -151,7 +300,7 @@ void Interface::run() {
 
 
 void Interface::show_menu() {
-    wclear(main_win);
+    clear_screen();
     
     if (has_colors()) {
         wattron(main_win, COLOR_PAIR(5));
@@ -167,19 +316,21 @@ void Interface::show_menu() {
     mvwprintw(main_win, 5, 5, "1. Record new macro");
     mvwprintw(main_win, 6, 5, "2. Play macro");
     mvwprintw(main_win, 7, 5, "3. List macros");
-    mvwprintw(main_win, 8, 5, "4. Exit");
-    mvwprintw(main_win, 10, 5, "Note: Use terminal for F9 to stop recording");
+    mvwprintw(main_win, 8, 5, "4. Optimize macro");
+    mvwprintw(main_win, 9, 5, "5. Play playlist");
+    mvwprintw(main_win, 10, 5, "6. Exit");
+    mvwprintw(main_win, 12, 5, "Note: Use terminal for F9 to stop recording");
     
     if (has_colors()) {
         wattroff(main_win, COLOR_PAIR(3));
     }
     
     wrefresh(main_win);
-    update_status("Use 1-4 to select option");
+    update_status("Use 1-6 to select option");
 }
 
 void Interface::show_recording_screen(const std::string& macro_name) {
-    wclear(main_win);
+    clear_screen();
     
     if (has_colors()) {
         wattron(main_win, COLOR_PAIR(2));
@@ -188,18 +339,38 @@ void Interface::show_recording_screen(const std::string& macro_name) {
     mvwprintw(main_win, 2, COLS/2 - 8, "RECORDING");
     mvwprintw(main_win, 4, 5, "Macro: %s", macro_name.c_str());
     mvwprintw(main_win, 6, 5, "Recording started...");
-    mvwprintw(main_win, 8, 5, "Press F9 in terminal to stop");
+    mvwprintw(main_win, 8, 5, "Press F9 or 's' to stop");
     
     if (has_colors()) {
         wattroff(main_win, COLOR_PAIR(2));
     }
     
     wrefresh(main_win);
-    update_status("Recording in progress... Press F9 in terminal to stop");
+    update_status("Recording in progress... Press F9 or 's' to stop");
+}
+
+void Interface::watch_recording() {
+    int64_t started = now_ms();
+    dirty = true;
+
+    while (recording_status_callback && recording_status_callback()) {
+        bool redraw;
+        int ch = next_event(redraw, 1000);
+        if ((ch == 's' || ch == 'S') && stop_recording_callback) {
+            stop_recording_callback();
+        }
+        if (!redraw) {
+            continue;
+        }
+
+        size_t events = recorded_events_callback ? recorded_events_callback() : 0;
+        set_field(10, format("Events: %zu   Elapsed: %.1f s", events, (now_ms() - started) / 1000.0));
+        wrefresh(main_win);
+    }
 }
 
 void Interface::show_playback_screen(const std::string& macro_name, int loop_count) {
-    wclear(main_win);
+    clear_screen();
     
     if (has_colors()) {
         wattron(main_win, COLOR_PAIR(3));
@@ -209,41 +380,169 @@ void Interface::show_playback_screen(const std::string& macro_name, int loop_cou
     mvwprintw(main_win, 4, 5, "Macro: %s", macro_name.c_str());
     mvwprintw(main_win, 5, 5, "Loops: %s", 
               loop_count == 0 ? "Infinite" : std::to_string(loop_count).c_str());
-    mvwprintw(main_win, 7, 5, "Playback started...");
+    mvwprintw(main_win, 7, 5, "State: Waiting");
     
     if (has_colors()) {
         wattroff(main_win, COLOR_PAIR(3));
     }
     
     wrefresh(main_win);
-    update_status("Playback in progress...");
+    update_status("Playback in progress... 's' or F10 to stop, any other key to return");
 }
 
-void Interface::show_macros_list(const std::vector<std::string>& macros) {
-    wclear(main_win);
-    
-    if (has_colors()) {
-        wattron(main_win, COLOR_PAIR(4));
+void Interface::watch_playback(uint64_t id) {
+    if (!playback_status_callback) {
+        return;
     }
-    
-    mvwprintw(main_win, 2, COLS/2 - 10, "AVAILABLE MACROS");
-    
-    if (has_colors()) {
-        wattroff(main_win, COLOR_PAIR(4));
+
+    // 's' stops the playback, any other key returns to the menu and leaves
+    // it running.
+    dirty = true;
+    PlaybackStatus status;
+    while (true) {
+        bool redraw;
+        int ch = next_event(redraw, 1000);
+        if (ch == 's' || ch == 'S') {
+            if (stop_playback_callback) {
+                stop_playback_callback(id);
+            }
+        } else if (ch != ERR || exit_requested) {
+            return;
+        }
+        if (!redraw) {
+            continue;
+        }
+
+        if (!playback_status_callback(id, status)) {
+            return;
+        }
+
+        std::string loops = status.loop_count == -1 ? "inf" : std::to_string(status.loop_count);
+        set_field(7, format("State: %s", state_name(status.state)));
+        if (!status.sequence.empty()) {
+            set_field(8, format("Entry %d: %s", status.segment, status.name.c_str()));
+        }
+        if (status.stats) {
+            PlaybackStatsSnapshot s = status.stats->snapshot(PlaybackScheduler::now_ns());
+            set_field(9, format("Loop: %d / %s   Elapsed: %.1f s", status.current_loop, loops.c_str(), s.elapsed_s));
+            set_field(10, format("Frames: %llu   Events: %llu   Writes: %llu",
+                                 static_cast<unsigned long long>(s.frames), static_cast<unsigned long long>(s.events),
+                                 static_cast<unsigned long long>(s.writes)));
+            set_field(11, format("Rate: %.0f events/s   Last loop: %.3f s", s.events_per_s, s.last_loop_ns / 1e9));
+            set_field(12, format("Lateness p50: %.1f us   p99: %.1f us   max: %.1f us",
+                                 s.p50_ns / 1000.0, s.p99_ns / 1000.0, s.max_ns / 1000.0));
+        }
+        wrefresh(main_win);
+
+        if (status.state == PlaybackState::Finished || status.state == PlaybackState::Stopped) {
+            update_status(status.state == PlaybackState::Stopped ? "Playback stopped - press any key"
+                                                                 : "Playback finished - press any key");
+            wait_for_key();
+            return;
+        }
     }
-    
-    if (macros.empty()) {
-        mvwprintw(main_win, 4, 5, "No macros found");
-    } else {
-        for (size_t i = 0; i < macros.size() && i < LINES - 8; i++) {
-            mvwprintw(main_win, 4 + i, 5, "%zu. %s", i + 1, macros[i].c_str());
+}
+
+void Interface::show_macros_list() {
+    if (!list_callback) {
+        return;
+    }
+
+    std::string filter;
+    MacroSort sort = MacroSort::Name;
+    bool descending = false;
+    std::vector<MacroInfo> macros = list_callback(filter, sort, descending);
+    size_t top = 0;
+
+    auto draw_title = [this]() {
+        clear_screen();
+        if (has_colors()) {
+            wattron(main_win, COLOR_PAIR(4));
         }
+        mvwprintw(main_win, 2, COLS/2 - 10, "AVAILABLE MACROS");
+        if (has_colors()) {
+            wattroff(main_win, COLOR_PAIR(4));
+        }
+    };
+    draw_title();
+
+    while (!exit_requested) {
+        // Only the visible rows are formatted, however large the library.
+        int name_width = std::max(COLS - 66, 12);
+        size_t visible = static_cast<size_t>(std::max(LINES - 12, 1));
+        if (macros.size() <= visible) {
+            top = 0;
+        } else {
+            top = std::min(top, macros.size() - visible);
+        }
+
+        set_field(4, format("%-*s %10s %9s %7s %9s  %-16s", name_width, "Name", "Duration", "Events", "Keys",
+                            "Size", "Modified"));
+        for (size_t i = 0; i < visible; i++) {
+            int row = 5 + static_cast<int>(i);
+            if (top + i >= macros.size()) {
+                set_field(row, top + i == 0 ? "No macros found" : "");
+                continue;
+            }
+
+            const MacroInfo& info = macros[top + i];
+            char modified[32];
+            tm local;
+            time_t seconds = info.mtime.tv_sec;
+            strftime(modified, sizeof(modified), "%Y-%m-%d %H:%M", localtime_r(&seconds, &local));
+            set_field(row, format("%-*.*s %9.1fs %9llu %7llu %8.1fK  %-16s", name_width, name_width,
+                                  info.name.c_str(), info.duration_us / 1e6,
+                                  static_cast<unsigned long long>(info.event_count),
+                                  static_cast<unsigned long long>(info.key_events), info.size / 1024.0, modified));
+        }
+        set_field(LINES - 6, "Sort: n)ame d)uration e)vents s)ize m)odified   /: filter   q: back");
+        wrefresh(main_win);
+
+        static const char* sort_names[] = {"name", "duration", "events", "size", "modified"};
+        std::string summary = std::to_string(macros.size()) + " macros, by " +
+                              sort_names[static_cast<int>(sort)] + (descending ? " (descending)" : "");
+        if (!filter.empty()) {
+            summary += ", matching \"" + filter + "\"";
+        }
+        update_status(summary);
+
+        int ch = wait_for_key();
+        MacroSort chosen = sort;
+        switch (ch) {
+            case KEY_UP: top = top > 0 ? top - 1 : 0; continue;
+            case KEY_DOWN: top++; continue;
+            case KEY_PPAGE: top = top > visible ? top - visible : 0; continue;
+            case KEY_NPAGE: top += visible; continue;
+            case KEY_HOME: top = 0; continue;
+            case KEY_END: top = macros.size(); continue;
+            case 'n': chosen = MacroSort::Name; break;
+            case 'd': chosen = MacroSort::Duration; break;
+            case 'e': chosen = MacroSort::Events; break;
+            case 's': chosen = MacroSort::Size; break;
+            case 'm': chosen = MacroSort::Modified; break;
+            case '/':
+                filter = get_input("Filter (blank for all): ");
+                draw_title();
+                break;
+            case 'q':
+            case 'Q':
+            case 27:
+            case '\n':
+            case KEY_LEFT:
+                return;
+            default:
+                continue;
+        }
+
+        // Picking the current column again flips it; the others start with
+        // the largest or newest first.
+        if (ch != '/') {
+            descending = chosen == sort ? !descending : chosen != MacroSort::Name;
+            sort = chosen;
+        }
+        macros = list_callback(filter, sort, descending);
+        top = 0;
     }
-    
-    mvwprintw(main_win, LINES - 6, 5, "Press any key to continue");
-    wrefresh(main_win);
-    update_status("Found " + std::to_string(macros.size()) + " macros");
-    getch();
 }
 
 void Interface::show_message(const std::string& message) {
@@ -258,18 +557,31 @@ void Interface::show_error(const std::string& error) {
     if (has_colors()) {
         wattroff(status_win, COLOR_PAIR(2));
     }
-    std::this_thread::sleep_for(std::chrono::seconds(2));
+    // Shown for two seconds unless a key dismisses it sooner.
+    wait_key(2000, false);
 }
 
 void Interface::set_recording_callback(std::function<void(const std::string&)> callback) {
     recording_callback = callback;
 }
 
-void Interface::set_playback_callback(std::function<void(const std::string&, int)> callback) {
+void Interface::set_playback_callback(std::function<uint64_t(const std::string&, int, double, double)> callback) {
     playback_callback = callback;
 }
 
-void Interface::set_list_callback(std::function<std::vector<std::string>()> callback) {
+void Interface::set_playlist_callback(std::function<uint64_t(const std::string&, int)> callback) {
+    playlist_callback = callback;
+}
+
+void Interface::set_playback_status_callback(std::function<bool(uint64_t, PlaybackStatus&)> callback) {
+    playback_status_callback = callback;
+}
+
+void Interface::set_stop_playback_callback(std::function<void(uint64_t)> callback) {
+    stop_playback_callback = callback;
+}
+
+void Interface::set_list_callback(std::function<std::vector<MacroInfo>(const std::string&, MacroSort, bool)> callback) {
     list_callback = callback;
 }
 
@@ -279,4 +591,12 @@ void Interface::set_stop_recording_callback(std::function<void()> callback) {
 
 void Interface::set_recording_status_callback(std::function<bool()> callback) {
     recording_status_callback = callback;
+}
+
+void Interface::set_optimize_callback(std::function<std::string(const std::string&)> callback) {
+    optimize_callback = callback;
+}
+
+void Interface::set_recorded_events_callback(std::function<size_t()> callback) {
+    recorded_events_callback = callback;
 }
\ No newline at end of file
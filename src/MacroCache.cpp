@@ -0,0 +1,80 @@
+#include "MacroCache.hpp"
+#include <sys/stat.h>
+
+MacroCache::MacroCache(size_t capacity) : capacity(capacity), hit_count(0), miss_count(0) {}
+
+std::shared_ptr<const MacroFile> MacroCache::get(const std::string& filename) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) == -1) {
+        invalidate(filename);
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(filename);
+        if (it != index.end()) {
+            const Entry& entry = *it->second;
+            if (entry.file_size == st.st_size && entry.mtime.tv_sec == st.st_mtim.tv_sec &&
+                entry.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                entries.splice(entries.begin(), entries, it->second);
+                hit_count++;
+                return entry.macro;
+            }
+            entries.erase(it->second);
+            index.erase(it);
+        }
+    }
+
+    // Verified once here, so a corrupt file is refused before it is played
+    // rather than replayed as garbage input.
+    miss_count++;
+    auto macro = std::make_shared<MacroFile>();
+    if (!macro->open(filename, true)) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(filename);
+    if (it != index.end()) {
+        entries.erase(it->second);
+        index.erase(it);
+    }
+    entries.push_front({filename, st.st_mtim, st.st_size, macro});
+    index[filename] = entries.begin();
+    evict();
+    return macro;
+}
+
+void MacroCache::invalidate(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(filename);
+    if (it != index.end()) {
+        entries.erase(it->second);
+        index.erase(it);
+    }
+}
+
+void MacroCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+}
+
+void MacroCache::set_capacity(size_t entries_limit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = entries_limit;
+    evict();
+}
+
+size_t MacroCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+void MacroCache::evict() {
+    while (entries.size() > capacity) {
+        index.erase(entries.back().path);
+        entries.pop_back();
+    }
+}
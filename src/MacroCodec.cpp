@@ -0,0 +1,121 @@
+#include "MacroCodec.hpp"
+#include <map>
+
+namespace {
+
+void put_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+bool get_varint(const uint8_t* data, size_t size, size_t& position, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && position < size; shift += 7) {
+        uint8_t byte = data[position++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+namespace utils {
+
+void encode_compact(const std::vector<MacroEvent>& events, std::vector<uint8_t>& out) {
+    std::map<uint32_t, uint32_t> index;
+    std::vector<EventKey> dictionary;
+    for (const auto& ev : events) {
+        uint32_t key = (static_cast<uint32_t>(ev.type) << 16) | ev.code;
+        if (index.emplace(key, static_cast<uint32_t>(dictionary.size())).second) {
+            dictionary.push_back({ev.type, ev.code});
+        }
+    }
+
+    out.clear();
+    out.reserve(events.size() * 4 + dictionary.size() * 3 + 8);
+
+    put_varint(out, dictionary.size());
+    for (const auto& key : dictionary) {
+        put_varint(out, key.type);
+        put_varint(out, key.code);
+    }
+
+    int64_t last_time = 0;
+    for (const auto& ev : events) {
+        put_varint(out, index[(static_cast<uint32_t>(ev.type) << 16) | ev.code]);
+        put_varint(out, zigzag(ev.time_us - last_time));
+        put_varint(out, zigzag(ev.value));
+        last_time = ev.time_us;
+    }
+}
+
+bool decode_dictionary(const uint8_t* data, size_t size, std::vector<EventKey>& dictionary, size_t& consumed) {
+    size_t position = 0;
+    uint64_t count;
+    if (!get_varint(data, size, position, count) || count > size) {
+        return false;
+    }
+
+    dictionary.clear();
+    dictionary.reserve(count);
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t type, code;
+        if (!get_varint(data, size, position, type) || !get_varint(data, size, position, code)) {
+            return false;
+        }
+        dictionary.push_back({static_cast<uint16_t>(type), static_cast<uint16_t>(code)});
+    }
+
+    consumed = position;
+    return true;
+}
+
+} // namespace utils
+
+CompactDecoder::CompactDecoder()
+    : stream(nullptr), stream_size(0), position(0), last_time(0), keys(nullptr) {}
+
+void CompactDecoder::reset(const uint8_t* data, size_t size, const std::vector<EventKey>* dictionary) {
+    stream = data;
+    stream_size = size;
+    keys = dictionary;
+    seek(0, 0);
+}
+
+void CompactDecoder::seek(size_t offset, int64_t time_us) {
+    position = offset;
+    last_time = time_us;
+}
+
+bool CompactDecoder::read_varint(uint64_t& value) {
+    return get_varint(stream, stream_size, position, value);
+}
+
+bool CompactDecoder::next(MacroEvent& ev) {
+    uint64_t key, delta, value;
+    if (position >= stream_size || !read_varint(key) || !read_varint(delta) || !read_varint(value) ||
+        key >= keys->size()) {
+        return false;
+    }
+
+    last_time += unzigzag(delta);
+    ev.time_us = last_time;
+    ev.type = (*keys)[key].type;
+    ev.code = (*keys)[key].code;
+    ev.value = static_cast<int32_t>(unzigzag(value));
+    return true;
+}
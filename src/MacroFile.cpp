@@ -0,0 +1,280 @@
+#include "MacroFile.hpp"
+#include "RealTime.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MacroFile::MacroFile()
+    : info{}, mapping(nullptr), mapping_size(0), event_data(nullptr),
+      stream(nullptr), stream_size(0), legacy(false), keyframes_built(false) {}
+
+MacroFile::~MacroFile() {
+    close();
+}
+
+bool MacroFile::open(const std::string& filename, bool verify_checksum) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t file_size = static_cast<size_t>(st.st_size);
+    MacroFileHeader file_header{};
+    bool versioned = file_size >= sizeof(file_header) &&
+                     pread(fd, &file_header, sizeof(file_header), 0) == sizeof(file_header) &&
+                     memcmp(file_header.magic, MACRO_MAGIC, sizeof(MACRO_MAGIC)) == 0;
+
+    if (!versioned) {
+        ::close(fd);
+        return open_legacy(filename);
+    }
+
+    // Counts are checked against the payload before anything sizes a buffer
+    // by them; a compact event takes at least one byte. Raw events are read
+    // in place, so the payload must start suitably aligned.
+    bool raw = file_header.encoding == MACRO_ENCODING_RAW;
+    size_t available = file_header.header_size <= file_size ? file_size - file_header.header_size : 0;
+    if (file_header.version != MACRO_VERSION ||
+        (!raw && file_header.encoding != MACRO_ENCODING_COMPACT) ||
+        file_header.header_size < sizeof(file_header) || file_header.header_size > file_size ||
+        file_header.header_size % alignof(MacroEvent) != 0 ||
+        file_header.event_count > (raw ? available / sizeof(MacroEvent) : available) ||
+        file_header.frame_count > file_header.event_count ||
+        (file_header.frame_count == 0) != (file_header.event_count == 0)) {
+        std::cout << "Unsupported or truncated macro file: " << filename << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping macro file");
+        return false;
+    }
+
+    const uint8_t* payload = static_cast<const uint8_t*>(map) + file_header.header_size;
+    size_t payload_size = raw ? file_header.event_count * sizeof(MacroEvent)
+                              : file_size - file_header.header_size;
+
+    if (verify_checksum && utils::checksum(payload, payload_size) != file_header.checksum) {
+        std::cout << "Checksum mismatch in macro file: " << filename << std::endl;
+        munmap(map, file_size);
+        return false;
+    }
+
+    if (!raw) {
+        size_t consumed = 0;
+        if (!utils::decode_dictionary(payload, payload_size, dictionary, consumed)) {
+            std::cout << "Corrupt macro dictionary: " << filename << std::endl;
+            munmap(map, file_size);
+            return false;
+        }
+        stream = payload + consumed;
+        stream_size = payload_size - consumed;
+    } else {
+        event_data = reinterpret_cast<const MacroEvent*>(payload);
+    }
+
+    madvise(map, file_size, MADV_SEQUENTIAL);
+
+    info = file_header;
+    mapping = map;
+    mapping_size = file_size;
+    return true;
+}
+
+bool MacroFile::open_legacy(const std::string& filename) {
+    MacroHeader legacy_header;
+    if (!utils::read_legacy_macro_file(filename, legacy_header, owned)) {
+        return false;
+    }
+
+    memcpy(info.magic, MACRO_MAGIC, sizeof(MACRO_MAGIC));
+    info.version = MACRO_VERSION;
+    info.encoding = MACRO_ENCODING_RAW;
+    info.start_x = legacy_header.start_x;
+    info.start_y = legacy_header.start_y;
+    info.event_count = owned.size();
+    info.frame_count = utils::count_frames(owned.data(), owned.size());
+    info.duration_us = owned.empty() ? 0 : owned.back().time_us;
+    info.checksum = utils::checksum(owned.data(), owned.size() * sizeof(MacroEvent));
+    info.header_size = sizeof(MacroFileHeader);
+
+    event_data = owned.data();
+    legacy = true;
+    return true;
+}
+
+void MacroFile::prefault() const {
+    if (mapping) {
+        utils::prefault_memory(mapping, mapping_size);
+    } else {
+        utils::prefault_memory(owned.data(), owned.size() * sizeof(MacroEvent));
+    }
+}
+
+const std::vector<MacroKeyframe>& MacroFile::keyframes() const {
+    std::lock_guard<std::mutex> lock(keyframe_mutex);
+    if (keyframes_built) {
+        return keyframe_index;
+    }
+
+    CompactDecoder decoder;
+    if (is_compact()) {
+        decoder.reset(stream, stream_size, &dictionary);
+    }
+
+    KeyState keys;
+    MacroEvent previous{};
+    int64_t next_keyframe = 0;
+    for (size_t i = 0; i < size(); i++) {
+        size_t offset = decoder.offset();
+        int64_t base_time = decoder.time_us();
+        MacroEvent ev;
+        if (is_compact()) {
+            if (!decoder.next(ev)) {
+                break;
+            }
+        } else {
+            ev = event_data[i];
+        }
+
+        bool frame_start = i == 0 || (previous.type == EV_SYN && previous.code == SYN_REPORT) ||
+                           previous.time_us != ev.time_us;
+        if (frame_start && ev.time_us >= next_keyframe) {
+            keyframe_index.push_back({ev.time_us, i, offset, base_time, keys});
+            next_keyframe = ev.time_us + KEYFRAME_INTERVAL_US;
+        }
+
+        utils::apply_key_events(keys, &ev, 1);
+        previous = ev;
+    }
+
+    keyframes_built = true;
+    return keyframe_index;
+}
+
+void MacroFile::close() {
+    if (mapping) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+        mapping_size = 0;
+    }
+    owned.clear();
+    owned.shrink_to_fit();
+    dictionary.clear();
+    event_data = nullptr;
+    stream = nullptr;
+    stream_size = 0;
+    std::lock_guard<std::mutex> lock(keyframe_mutex);
+    keyframes_built = false;
+    keyframe_index.clear();
+    legacy = false;
+    info = MacroFileHeader{};
+}
+
+MacroCursor::MacroCursor(const MacroFile& file)
+    : file(file), position(0), last_frame(nullptr), last_count(0), replay(false),
+      lookahead{}, has_lookahead(false) {
+    rewind();
+}
+
+void MacroCursor::rewind() {
+    position = 0;
+    replay = false;
+    has_lookahead = false;
+    if (file.is_compact()) {
+        decoder.reset(file.stream, file.stream_size, &file.dictionary);
+    }
+}
+
+void MacroCursor::seek(int64_t time_us, KeyState& keys) {
+    const auto& index = file.keyframes();
+    keys.reset();
+    rewind();
+
+    auto it = std::upper_bound(index.begin(), index.end(), time_us,
+                               [](int64_t t, const MacroKeyframe& kf) { return t < kf.time_us; });
+    if (it != index.begin()) {
+        const MacroKeyframe& keyframe = *(it - 1);
+        keys = keyframe.keys;
+        position = keyframe.event_index;
+        if (file.is_compact()) {
+            decoder.seek(keyframe.stream_offset, keyframe.stream_time_us);
+        }
+    }
+
+    size_t count;
+    while (const MacroEvent* frame = next_frame(count)) {
+        if (frame->time_us >= time_us) {
+            replay = true;
+            break;
+        }
+        utils::apply_key_events(keys, frame, count);
+    }
+}
+
+const MacroEvent* MacroCursor::next_frame(size_t& count) {
+    if (replay) {
+        replay = false;
+        count = last_count;
+        return last_frame;
+    }
+
+    if (!file.is_compact()) {
+        if (position >= file.size()) {
+            return nullptr;
+        }
+        const MacroEvent* start = file.events() + position;
+        count = utils::frame_length(start, file.size() - position);
+        position += count;
+        last_frame = start;
+        last_count = count;
+        return start;
+    }
+
+    frame.clear();
+    if (has_lookahead) {
+        frame.push_back(lookahead);
+        has_lookahead = false;
+    } else {
+        MacroEvent ev;
+        if (!decoder.next(ev)) {
+            return nullptr;
+        }
+        frame.push_back(ev);
+    }
+
+    // Same frame boundaries as utils::frame_length, decided one event ahead.
+    while (!(frame.back().type == EV_SYN && frame.back().code == SYN_REPORT)) {
+        MacroEvent ev;
+        if (!decoder.next(ev)) {
+            break;
+        }
+        if (ev.time_us != frame.front().time_us) {
+            lookahead = ev;
+            has_lookahead = true;
+            break;
+        }
+        frame.push_back(ev);
+    }
+
+    position += frame.size();
+    count = frame.size();
+    last_frame = frame.data();
+    last_count = count;
+    return frame.data();
+}
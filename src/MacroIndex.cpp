@@ -0,0 +1,249 @@
+#include "MacroIndex.hpp"
+#include "MacroFile.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+
+namespace {
+
+const std::string MACRO_EXTENSION = ".macro";
+
+bool same_file(const MacroInfo& info, const struct stat& st) {
+    return info.size == static_cast<uint64_t>(st.st_size) && info.inode == st.st_ino &&
+           info.mtime.tv_sec == st.st_mtim.tv_sec && info.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+std::string lowercase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+}
+
+bool earlier(const timespec& a, const timespec& b) {
+    return a.tv_sec != b.tv_sec ? a.tv_sec < b.tv_sec : a.tv_nsec < b.tv_nsec;
+}
+
+}
+
+MacroIndex::MacroIndex() : loaded(false), probes(0) {}
+
+void MacroIndex::set_directory(const std::string& dir) {
+    std::lock_guard<std::mutex> lock(mutex);
+    macros_dir = dir;
+    index_file = dir + "/.index";
+    known.clear();
+    loaded = false;
+}
+
+bool MacroIndex::probe(const std::string& filename, MacroInfo& info) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) == -1) {
+        return false;
+    }
+
+    MacroFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    info.size = static_cast<uint64_t>(st.st_size);
+    info.mtime = st.st_mtim;
+    info.inode = st.st_ino;
+    info.duration_us = file.duration_us();
+    info.event_count = file.size();
+    info.frame_count = file.frame_count();
+    info.start_x = file.start_x();
+    info.start_y = file.start_y();
+    info.checksum = file.header().checksum;
+    info.encoding = file.is_legacy() ? "legacy" : file.is_compact() ? "compact" : "raw";
+
+    info.key_events = info.rel_events = info.syn_events = info.other_events = 0;
+    MacroCursor cursor(file);
+    size_t count;
+    while (const MacroEvent* frame = cursor.next_frame(count)) {
+        for (size_t i = 0; i < count; i++) {
+            switch (frame[i].type) {
+                case EV_KEY: info.key_events++; break;
+                case EV_REL: info.rel_events++; break;
+                case EV_SYN: info.syn_events++; break;
+                default: info.other_events++; break;
+            }
+        }
+    }
+    return true;
+}
+
+size_t MacroIndex::refresh() {
+    std::string dir;
+    std::map<std::string, MacroInfo> previous;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded) {
+            known = load_index();
+            loaded = true;
+        }
+        dir = macros_dir;
+        previous = known;
+    }
+
+    std::map<std::string, MacroInfo> found;
+    size_t read = 0;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (entry.path().extension() != MACRO_EXTENSION) {
+            continue;
+        }
+
+        std::string path = entry.path().string();
+        std::string name = entry.path().stem().string();
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        auto it = previous.find(name);
+        if (it != previous.end() && same_file(it->second, st)) {
+            found[name] = it->second;
+            continue;
+        }
+
+        MacroInfo info;
+        info.name = name;
+        read++;
+        probes++;
+        if (probe(path, info)) {
+            found[name] = info;
+        }
+    }
+    if (ec) {
+        std::cout << "Error reading macros directory: " << ec.message() << std::endl;
+        return read;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (dir != macros_dir) {
+        return read;
+    }
+    bool changed = read > 0 || found.size() != known.size();
+    known = std::move(found);
+    if (changed) {
+        save_index();
+    }
+    return read;
+}
+
+bool MacroIndex::update(const std::string& name) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        path = macros_dir + "/" + name + MACRO_EXTENSION;
+    }
+
+    MacroInfo info;
+    info.name = name;
+    probes++;
+    bool ok = probe(path, info);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!loaded) {
+        known = load_index();
+        loaded = true;
+    }
+    if (ok) {
+        known[name] = info;
+    } else {
+        known.erase(name);
+    }
+    save_index();
+    return ok;
+}
+
+std::vector<MacroInfo> MacroIndex::query(const std::string& filter, MacroSort sort, bool descending) const {
+    std::vector<MacroInfo> result;
+    std::string needle = lowercase(filter);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        result.reserve(known.size());
+        for (const auto& entry : known) {
+            if (needle.empty() || lowercase(entry.first).find(needle) != std::string::npos) {
+                result.push_back(entry.second);
+            }
+        }
+    }
+
+    // Ties keep name order, which is what the map already yields.
+    auto less = [sort](const MacroInfo& a, const MacroInfo& b) {
+        switch (sort) {
+            case MacroSort::Duration: return a.duration_us < b.duration_us;
+            case MacroSort::Events: return a.event_count < b.event_count;
+            case MacroSort::Size: return a.size < b.size;
+            case MacroSort::Modified: return earlier(a.mtime, b.mtime);
+            case MacroSort::Name: break;
+        }
+        return a.name < b.name;
+    };
+    if (descending) {
+        std::stable_sort(result.begin(), result.end(), [&](const MacroInfo& a, const MacroInfo& b) {
+            return less(b, a);
+        });
+    } else {
+        std::stable_sort(result.begin(), result.end(), less);
+    }
+    return result;
+}
+
+std::map<std::string, MacroInfo> MacroIndex::load_index() const {
+    std::map<std::string, MacroInfo> cached;
+    if (index_file.empty()) {
+        return cached;
+    }
+
+    for (const auto& fields : utils::read_tab_records(index_file, 16)) {
+        try {
+            MacroInfo info;
+            info.name = fields[0];
+            info.size = std::stoull(fields[1]);
+            info.mtime.tv_sec = static_cast<time_t>(std::stoll(fields[2]));
+            info.mtime.tv_nsec = std::stol(fields[3]);
+            info.inode = static_cast<ino_t>(std::stoull(fields[4]));
+            info.duration_us = std::stoll(fields[5]);
+            info.event_count = std::stoull(fields[6]);
+            info.frame_count = std::stoull(fields[7]);
+            info.key_events = std::stoull(fields[8]);
+            info.rel_events = std::stoull(fields[9]);
+            info.syn_events = std::stoull(fields[10]);
+            info.other_events = std::stoull(fields[11]);
+            info.start_x = std::stoi(fields[12]);
+            info.start_y = std::stoi(fields[13]);
+            info.checksum = static_cast<uint32_t>(std::stoul(fields[14], nullptr, 16));
+            info.encoding = fields[15];
+            cached[info.name] = info;
+        } catch (const std::exception&) {
+            continue;
+        }
+    }
+    return cached;
+}
+
+void MacroIndex::save_index() const {
+    if (index_file.empty()) {
+        return;
+    }
+
+    std::ostringstream file;
+    file << "# macrowise macro index v1\n";
+    for (const auto& entry : known) {
+        const MacroInfo& info = entry.second;
+        file << info.name << '\t' << info.size << '\t' << info.mtime.tv_sec << '\t' << info.mtime.tv_nsec
+             << '\t' << info.inode << '\t' << info.duration_us << '\t' << info.event_count << '\t'
+             << info.frame_count << '\t' << info.key_events << '\t' << info.rel_events << '\t'
+             << info.syn_events << '\t' << info.other_events << '\t' << info.start_x << '\t' << info.start_y
+             << std::hex << '\t' << info.checksum << std::dec << '\t' << info.encoding << '\n';
+    }
+    if (!utils::write_file_atomic(index_file, file.str())) {
+        perror(("Error writing " + index_file).c_str());
+    }
+}
@@ -0,0 +1,81 @@
+#include "MacroOptimizer.hpp"
+#include <sstream>
+
+namespace {
+
+bool is_syn_report(const MacroEvent& ev) {
+    return ev.type == EV_SYN && ev.code == SYN_REPORT;
+}
+
+}
+
+std::string OptimizeStats::summary() const {
+    std::ostringstream out;
+    out << "removed " << removed() << " of " << events_in << " events ("
+        << misc_dropped << " misc, " << repeats_dropped << " key repeats, "
+        << empty_frames_dropped << " empty frames)";
+    if (idle_trimmed_us > 0) {
+        out << ", trimmed " << idle_trimmed_us / 1000 << " ms idle";
+    }
+    return out.str();
+}
+
+MacroFilter::MacroFilter(const OptimizeOptions& options)
+    : options(options), last{}, has_last(false), shift(0) {}
+
+size_t MacroFilter::apply(MacroEvent* events, size_t count) {
+    totals.events_in += count;
+
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++) {
+        MacroEvent ev = events[i];
+
+        // EV_MSC is not advertised by UInputDevice, so the kernel would
+        // discard it on playback anyway.
+        if (options.drop_misc && ev.type == EV_MSC) {
+            totals.misc_dropped++;
+            continue;
+        }
+        if (options.drop_key_repeats && ev.type == EV_KEY && ev.value == 2) {
+            totals.repeats_dropped++;
+            continue;
+        }
+
+        // A SYN_REPORT that closes nothing (the previous event already ended
+        // a frame) produces no input for the application.
+        if (options.drop_empty_frames && is_syn_report(ev) &&
+            (!has_last || is_syn_report(last) || last.time_us != ev.time_us)) {
+            totals.empty_frames_dropped++;
+            continue;
+        }
+
+        int64_t time_us = ev.time_us;
+        if (options.trim_idle) {
+            int64_t gap = has_last ? time_us - last.time_us : 0;
+            if (!has_last) {
+                shift = time_us;
+            } else if (options.max_idle_us > 0 && gap > options.max_idle_us) {
+                shift += gap - options.max_idle_us;
+            }
+            ev.time_us -= shift;
+        }
+
+        last = events[i];
+        has_last = true;
+        events[out++] = ev;
+    }
+
+    totals.idle_trimmed_us = shift;
+    totals.events_out += out;
+    return out;
+}
+
+namespace utils {
+
+OptimizeStats optimize_macro(std::vector<MacroEvent>& events, const OptimizeOptions& options) {
+    MacroFilter filter(options);
+    events.resize(filter.apply(events.data(), events.size()));
+    return filter.stats();
+}
+
+} // namespace utils
@@ -1,219 +1,499 @@
 #include "MacroRecorder.hpp"
 #include "utils.hpp"
 #include "UInputDevice.hpp"
+#include "MacroFile.hpp"
+#include "MacroWriter.hpp"
+#include "DeviceRegistry.hpp"
+#include "Playlist.hpp"
 #include <iostream>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <sys/ioctl.h>
 #include <sys/time.h>
 #include <thread>
 #include <cstring>
+#include <memory>
+
+namespace {
+
+// What playback can reproduce; EV_MSC scan codes and the like are left in
+// the kernel.
+constexpr unsigned int RECORDED_EVENTS = (1u << EV_SYN) | (1u << EV_KEY) | (1u << EV_REL);
+constexpr unsigned int KEYBOARD_EVENTS = 1u << EV_KEY;
+
+// Gamepads, tablets and touchscreens report EV_ABS, which the virtual
+// device cannot replay.
+bool has_absolute_axes(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    unsigned long bits[EV_MAX / (8 * sizeof(unsigned long)) + 1] = {0};
+    bool absolute = ioctl(fd, EVIOCGBIT(0, sizeof(bits)), bits) >= 0 &&
+                    (bits[EV_ABS / (8 * sizeof(unsigned long))] >> (EV_ABS % (8 * sizeof(unsigned long)))) & 1;
+    close(fd);
+    return absolute;
+}
+
+}
 
 MacroRecorder::MacroRecorder(const std::string& mouse_device, const std::string& keyboard_device)
     : mouse_device(mouse_device), keyboard_device(keyboard_device),
-      macros_dir("/macroses"), start_delay(3),
-      recording(false), should_exit_flag(false) {}
+      macros_dir("/macroses"), start_delay(3), compact_storage(false), exclusive_grab(false), playback_grab(false),
+      recording(false), capturing(false), should_exit_flag(false), recorded_events(0), playback_grabbed(false), engine(uinput) {
+    index.set_directory(macros_dir);
+    engine.set_stats_directory(macros_dir);
+    engine.set_progress_callback([this]() {
+        on_engine_progress();
+    });
+}
 
 MacroRecorder::~MacroRecorder() {
     stop_recording();
+    if (record_thread.joinable()) {
+        record_thread.join();
+    }
+
+    // Stopping the playlists releases their prefetchers from wait_drained().
+    should_exit_flag = true;
+    engine.stop_all();
+    std::lock_guard<std::mutex> lock(prefetch_mutex);
+    for (auto& prefetcher : prefetchers) {
+        prefetcher.thread.join();
+    }
 }
 
 void MacroRecorder::start_recording(const std::string& macro_name) {
-    if (recording) {
-        std::cout << "Already recording!" << std::endl;
+    if (!claim_recording()) {
         return;
     }
+    record(macro_name);
+}
+
+bool MacroRecorder::begin_recording(const std::string& macro_name) {
+    if (!claim_recording()) {
+        return false;
+    }
+    if (record_thread.joinable()) {
+        record_thread.join();
+    }
+    record_thread = std::thread([this, macro_name]() {
+        record(macro_name);
+        report_progress();
+    });
+    return true;
+}
 
+bool MacroRecorder::claim_recording() {
+    std::lock_guard<std::mutex> lock(record_mutex);
+    if (recording) {
+        std::cout << "Already recording!" << std::endl;
+        return false;
+    }
     recording = true;
-    events.clear();
-    
-    int mouse_fd = open(mouse_device.c_str(), O_RDONLY | O_NONBLOCK);
-    int keyboard_fd = open(keyboard_device.c_str(), O_RDONLY | O_NONBLOCK);
+    capturing = true;
+    return true;
+}
 
-    if (mouse_fd == -1 || keyboard_fd == -1) {
-        perror("Error opening input devices");
-        recording = false;
-        return;
+void MacroRecorder::record(const std::string& macro_name) {
+    recorded_events = 0;
+
+    std::vector<uint64_t> acquired;
+    auto release_devices = [&]() {
+        for (uint64_t id : acquired) {
+            reactor.release(id);
+        }
+    };
+
+    struct Wanted {
+        const std::string& spec;
+        unsigned int capability;
+        unsigned int type_mask;
+    };
+    std::vector<Wanted> wanted = {
+        {mouse_device, DEVICE_POINTER, RECORDED_EVENTS},
+        {keyboard_device, DEVICE_KEYBOARD, KEYBOARD_EVENTS},
+    };
+    for (const auto& device : extra_devices) {
+        wanted.push_back({device, DEVICE_POINTER, RECORDED_EVENTS});
+    }
+
+    for (size_t i = 0; i < wanted.size(); i++) {
+        std::string path;
+        if (i >= 2 && reactor.resolve(wanted[i].spec, wanted[i].capability, path) && has_absolute_axes(path)) {
+            std::cout << "Skipping input device " << wanted[i].spec
+                      << ": absolute axes (gamepads, tablets) cannot be recorded" << std::endl;
+            continue;
+        }
+        uint64_t id = reactor.acquire(wanted[i].spec, wanted[i].capability, wanted[i].type_mask);
+        if (id != 0) {
+            acquired.push_back(id);
+        } else if (i < 2) {
+            std::cout << "Error opening input devices" << std::endl;
+            release_devices();
+            recording = false;
+            return;
+        } else {
+            std::cout << "Skipping input device " << wanted[i].spec << std::endl;
+        }
     }
 
     int start_x, start_y;
     utils::get_current_cursor_position(start_x, start_y);
     std::cout << "Starting cursor position: " << start_x << ", " << start_y << std::endl;
 
-    timeval start_time;
-    gettimeofday(&start_time, nullptr);
+    fs::create_directories(macros_dir);
+    std::string filename = macros_dir + "/" + macro_name + ".macro";
+
+    MacroWriter writer;
+    if (!writer.open(filename, MacroHeader{start_x, start_y})) {
+        std::cout << "Error saving macro" << std::endl;
+        release_devices();
+        recording = false;
+        return;
+    }
+
+    // Optimizing on the writer thread keeps the recording a single stream
+    // to disk instead of reading it back and rewriting it afterwards.
+    std::unique_ptr<MacroFilter> filter;
+    if (optimize_options.enabled) {
+        filter = std::make_unique<MacroFilter>(optimize_options);
+    }
+    auto ring = std::make_unique<RecordRing>();
+    std::atomic<bool> capture_done(false);
+    bool written = false;
+    std::thread writer_thread([&]() {
+        written = write_events(*ring, writer, filter.get(), capture_done);
+    });
+
+    if (exclusive_grab) {
+        reactor.hold_grab();
+    }
+    size_t overruns = reactor.drop_count();
+    timeval start_time = utils::monotonic_time();
     std::cout << "Recording started... Press F9 to stop" << std::endl;
 
-    while (recording && !should_exit_flag) {
-        input_event ev;
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(mouse_fd, &fds);
-        FD_SET(keyboard_fd, &fds);
-
-        timeval timeout{0, 100000};
-        int max_fd = std::max(mouse_fd, keyboard_fd) + 1;
-        
-        if (select(max_fd, &fds, nullptr, nullptr, &timeout) > 0) {
-            if (FD_ISSET(mouse_fd, &fds) && read(mouse_fd, &ev, sizeof(ev)) == sizeof(ev)) {
-                timeval current_time, relative_time;
-                gettimeofday(&current_time, nullptr);
-                timersub(&current_time, &start_time, &relative_time);
-                
-                input_event timed_ev = ev;
-                timed_ev.time = relative_time;
-                events.push_back(timed_ev);
+    // Runs on the reactor thread; the ring is its only link to this one.
+    MacroEvent staged[256];
+    size_t dropped = 0;
+    size_t captured = 0;
+    uint64_t subscription = reactor.subscribe([&](const input_event* events, size_t count) {
+        size_t staged_count = 0;
+        for (size_t i = 0; i < count; i++) {
+            const input_event& ev = events[i];
+            timeval relative_time{0, 0};
+            if (!timercmp(&ev.time, &start_time, <)) {
+                timersub(&ev.time, &start_time, &relative_time);
             }
-            
-            if (FD_ISSET(keyboard_fd, &fds) && read(keyboard_fd, &ev, sizeof(ev)) == sizeof(ev) && ev.type == EV_KEY) {
-                timeval current_time, relative_time;
-                gettimeofday(&current_time, nullptr);
-                timersub(&current_time, &start_time, &relative_time);
-                
-                input_event timed_ev = ev;
-                timed_ev.time = relative_time;
-                events.push_back(timed_ev);
+            int64_t time_us = static_cast<int64_t>(relative_time.tv_sec) * 1000000 + relative_time.tv_usec;
+            staged[staged_count++] = {time_us, ev.type, ev.code, ev.value};
+
+            if (staged_count == 256) {
+                dropped += staged_count - ring->push(staged, staged_count);
+                staged_count = 0;
             }
         }
+
+        dropped += staged_count - ring->push(staged, staged_count);
+        captured += count;
+        recorded_events = captured;
+        report_progress();
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(record_mutex);
+        record_stopped.wait(lock, [this]() {
+            return !capturing || should_exit_flag;
+        });
     }
 
-    close(mouse_fd);
-    close(keyboard_fd);
+    reactor.unsubscribe(subscription);
+    if (exclusive_grab) {
+        reactor.release_grab();
+    }
+    release_devices();
+    overruns = reactor.drop_count() - overruns;
+    capture_done = true;
+    writer_thread.join();
+
+    // A failed or empty take leaves any earlier macro of that name alone.
+    size_t saved_events = writer.event_count();
+    bool saved = false;
+    if (written && saved_events > 0) {
+        saved = writer.finish();
+    } else {
+        writer.discard();
+    }
+    if (filter) {
+        std::cout << "Optimized: " << filter->stats().summary() << std::endl;
+    }
+    if (saved && compact_storage) {
+        MacroHeader header;
+        std::vector<MacroEvent> recorded;
+        saved = utils::read_macro_file(filename, header, recorded) &&
+                utils::write_macro_file(filename, header, recorded, true);
+    }
 
-    MacroHeader header{start_x, start_y};
-    
-    fs::create_directories(macros_dir);
-    std::string filename = macros_dir + "/" + macro_name + ".macro";
-    
-    if (utils::write_macro_file(filename, header, events)) {
-        std::cout << "Macro saved: " << filename << " (" << events.size() << " events)" << std::endl;
+    cache.invalidate(filename);
+    index.update(macro_name);
+    if (saved) {
+        std::cout << "Macro saved: " << filename << " (" << saved_events << " events)" << std::endl;
+    } else if (!written) {
+        std::cout << "Error writing macro, nothing was saved" << std::endl;
+    } else if (saved_events == 0) {
+        std::cout << "No events recorded, nothing was saved" << std::endl;
     } else {
         std::cout << "Error saving macro" << std::endl;
     }
+    if (dropped > 0) {
+        std::cout << "Warning: " << dropped << " events dropped, disk writer fell behind" << std::endl;
+    }
+    if (overruns > 0) {
+        std::cout << "Warning: input overran " << overruns
+                  << " times (SYN_DROPPED), key state was resynced" << std::endl;
+    }
     
     recording = false;
 }
 
-void MacroRecorder::stop_recording() {
-    recording = false;
+void MacroRecorder::set_progress_callback(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    on_progress = callback;
 }
 
-void MacroRecorder::record_events() {
-    int mouse_fd = open(mouse_device.c_str(), O_RDONLY | O_NONBLOCK);
-    int keyboard_fd = open(keyboard_device.c_str(), O_RDONLY | O_NONBLOCK);
+void MacroRecorder::report_progress() {
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    if (on_progress) {
+        on_progress();
+    }
+}
 
-    if (mouse_fd == -1 || keyboard_fd == -1) {
-        perror("Error opening input devices");
-        recording = false;
-        return;
+void MacroRecorder::on_engine_progress() {
+    report_progress();
+
+    // Runs on the engine thread, the only place the grab changes hands.
+    bool active = playback_grab && engine.active_count() > 0;
+    if (active != playback_grabbed.exchange(active)) {
+        if (active) {
+            reactor.hold_grab();
+        } else {
+            reactor.release_grab();
+        }
     }
+}
 
-    gettimeofday(&start_time, nullptr);
-    std::cout << "Recording started... Press F9 to stop" << std::endl;
+// Returns false if any write failed. After a failure the ring is still
+// drained, but nothing more is appended: a partial write would leave the
+// events after it misaligned, while the header keeps the file valid up to
+// the last complete append.
+bool MacroRecorder::write_events(RecordRing& ring, MacroWriter& writer, MacroFilter* filter,
+                                 const std::atomic<bool>& capture_done) {
+    constexpr auto FLUSH_INTERVAL = std::chrono::seconds(1);
+
+    std::vector<MacroEvent> chunk(4096);
+    auto last_flush = std::chrono::steady_clock::now();
+    bool ok = true;
+
+    while (true) {
+        bool done = capture_done.load();
+        size_t n = ring.pop(chunk.data(), chunk.size());
+        size_t kept = filter && n > 0 ? filter->apply(chunk.data(), n) : n;
+        if (kept > 0 && ok) {
+            ok = writer.append(chunk.data(), kept);
+        }
 
-    while (recording && !should_exit_flag) {
-        input_event ev;
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(mouse_fd, &fds);
-        FD_SET(keyboard_fd, &fds);
-
-        timeval timeout{0, 100000};
-        int max_fd = std::max(mouse_fd, keyboard_fd) + 1;
-        
-        if (select(max_fd, &fds, nullptr, nullptr, &timeout) > 0) {
-            if (FD_ISSET(mouse_fd, &fds) && read(mouse_fd, &ev, sizeof(ev)) == sizeof(ev)) {
-                timeval current_time, relative_time;
-                gettimeofday(&current_time, nullptr);
-                timersub(&current_time, &start_time, &relative_time);
-                
-                input_event timed_ev = ev;
-                timed_ev.time = relative_time;
-                events.push_back(timed_ev);
-            }
-            
-            if (FD_ISSET(keyboard_fd, &fds) && read(keyboard_fd, &ev, sizeof(ev)) == sizeof(ev) && ev.type == EV_KEY) {
-                timeval current_time, relative_time;
-                gettimeofday(&current_time, nullptr);
-                timersub(&current_time, &start_time, &relative_time);
-                
-                input_event timed_ev = ev;
-                timed_ev.time = relative_time;
-                events.push_back(timed_ev);
+        if (std::chrono::steady_clock::now() - last_flush >= FLUSH_INTERVAL) {
+            writer.flush();
+            last_flush = std::chrono::steady_clock::now();
+        }
+
+        if (n == 0) {
+            if (done) {
+                break;
             }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
         }
     }
+    return ok;
+}
 
-    close(mouse_fd);
-    close(keyboard_fd);
-    recording = false;
+void MacroRecorder::stop_recording() {
+    {
+        std::lock_guard<std::mutex> lock(record_mutex);
+        capturing = false;
+    }
+    record_stopped.notify_all();
+}
+
+uint64_t MacroRecorder::play_macro(const std::string& macro_name, int loop_count, double start_offset_s, double speed) {
+    // Checked here, before the seconds are converted to microseconds.
+    if (!PlaybackRequest::valid_offset(start_offset_s)) {
+        std::cout << "Invalid start offset: " << start_offset_s << " s" << std::endl;
+        return 0;
+    }
+    std::cout << "Starting playback in " << start_delay << " seconds..." << std::endl;
+
+    PlaybackRequest request;
+    request.loop_count = loop_count;
+    request.start_offset_us = static_cast<int64_t>(start_offset_s * 1000000);
+    request.speed = speed;
+    request.delay_us = static_cast<int64_t>(start_delay) * 1000000;
+    return play_macro(macro_name, request);
 }
 
-void MacroRecorder::play_macro(const std::string& macro_name, int loop_count) {
+uint64_t MacroRecorder::play_macro(const std::string& macro_name, PlaybackRequest request) {
+    if (!request.valid()) {
+        std::cout << "Invalid playback options: speed must be " << PlaybackRequest::MIN_SPEED << " to "
+                  << PlaybackRequest::MAX_SPEED << ", offsets at most a year" << std::endl;
+        return 0;
+    }
+
     std::string filename = macros_dir + "/" + macro_name + ".macro";
-    MacroHeader header;
-    std::vector<input_event> macro_events;
+    auto macro = cache.get(filename);
     
-    if (!utils::read_macro_file(filename, header, macro_events)) {
+    if (!macro) {
         std::cout << "Error opening macro file: " << filename << std::endl;
-        return;
+        return 0;
     }
 
-    std::cout << "Starting playback in " << start_delay << " seconds..." << std::endl;
-    std::this_thread::sleep_for(std::chrono::seconds(start_delay));
+    if (!prepare_playback()) {
+        std::cout << "Failed to create virtual input device" << std::endl;
+        return 0;
+    }
 
-    std::thread([this, macro_events, header, loop_count]() {
-        play_macro_loop(macro_events, header.start_x, header.start_y, loop_count);
-    }).detach();
+    request.name = macro_name;
+    request.macro = macro;
+    return engine.start(request);
 }
 
-void MacroRecorder::play_macro_loop(const std::vector<input_event>& macro_events, int start_x, int start_y, int loop_count) {
-    UInputDevice uinput;
-    if (!uinput.initialize()) {
-        std::cout << "Failed to create virtual input device" << std::endl;
-        return;
+bool MacroRecorder::preload_macro(const std::string& macro_name) {
+    auto macro = cache.get(macros_dir + "/" + macro_name + ".macro");
+    if (!macro) {
+        return false;
     }
+    macro->prefault();
+    return true;
+}
 
-    int current_loop = 0;
-    bool infinite = (loop_count == -1);
+uint64_t MacroRecorder::play_playlist(const std::string& playlist_name, int loop_count, int64_t delay_us) {
+    Playlist playlist;
+    std::string filename = macros_dir + "/" + playlist_name + ".playlist";
+    if (!playlist.load(filename) || playlist.entries().empty()) {
+        std::cout << "Error opening playlist: " << filename << std::endl;
+        return 0;
+    }
+    if (!prepare_playback()) {
+        std::cout << "Failed to create virtual input device" << std::endl;
+        return 0;
+    }
 
-    while ((infinite || current_loop < loop_count) && !should_exit_flag) {
-        current_loop++;
-        
-        utils::set_cursor_position(start_x, start_y);
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    PlaybackRequest first = playlist.entries().front();
+    if (!load_entry(first)) {
+        return 0;
+    }
+    first.sequence = playlist_name;
+    first.open = true;
+    first.delay_us += delay_us;
+    uint64_t id = engine.start(first);
+    if (id == 0) {
+        return 0;
+    }
 
-        timeval start_time;
-        gettimeofday(&start_time, nullptr);
+    std::lock_guard<std::mutex> lock(prefetch_mutex);
+    for (auto it = prefetchers.begin(); it != prefetchers.end();) {
+        if (*it->done) {
+            it->thread.join();
+            it = prefetchers.erase(it);
+        } else {
+            ++it;
+        }
+    }
 
-        for (size_t i = 0; i < macro_events.size(); i++) {
-            const auto& event = macro_events[i];
+    auto done = std::make_shared<std::atomic<bool>>(false);
+    std::vector<PlaybackRequest> entries = playlist.entries();
+    prefetchers.push_back({std::thread([this, id, entries, loop_count, done]() {
+        prefetch_playlist(id, entries, loop_count);
+        *done = true;
+    }), done});
+    return id;
+}
 
-            if (i > 0) {
-                timeval current_time, elapsed;
-                gettimeofday(&current_time, nullptr);
-                timersub(&current_time, &start_time, &elapsed);
+// Everything that would otherwise stall the scheduler at the handoff: the
+// file read, its page faults and, for an offset start, the seek index.
+bool MacroRecorder::load_entry(PlaybackRequest& entry) {
+    std::string filename = macros_dir + "/" + entry.name + ".macro";
+    entry.macro = cache.get(filename);
+    if (!entry.macro) {
+        std::cout << "Error opening macro file: " << filename << std::endl;
+        return false;
+    }
+    entry.macro->prefault();
+    if (entry.start_offset_us > 0) {
+        entry.macro->keyframes();
+    }
+    return true;
+}
 
-                if (timercmp(&elapsed, &event.time, <)) {
-                    timeval sleep_time;
-                    timersub(&event.time, &elapsed, &sleep_time);
-                    long sleep_us = sleep_time.tv_sec * 1000000 + sleep_time.tv_usec;
-                    if (sleep_us > 0) {
-                        std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
-                    }
-                }
+// Stays one entry ahead: the next entry is queued while the current one
+// plays, and only once it has taken over is the one after it loaded.
+void MacroRecorder::prefetch_playlist(uint64_t id, std::vector<PlaybackRequest> entries, int loop_count) {
+    size_t total = loop_count == -1 ? SIZE_MAX : entries.size() * static_cast<size_t>(loop_count);
+    size_t failed = 0;
+    for (size_t i = 1; i < total && !should_exit_flag; i++) {
+        PlaybackRequest next = entries[i % entries.size()];
+        if (!load_entry(next)) {
+            // A pass that loads nothing would otherwise spin forever.
+            if (++failed >= entries.size()) {
+                break;
             }
-
-            uinput.emit_event(event);
-            
-            if (should_exit_flag) break;
+            continue;
         }
+        failed = 0;
+        if (!engine.append(id, next) || !engine.wait_drained(id)) {
+            return;
+        }
+    }
+    engine.seal(id);
+}
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        if (should_exit_flag) break;
+void MacroRecorder::stop_playback(uint64_t id) {
+    engine.stop(id);
+}
+
+void MacroRecorder::stop_all_playback() {
+    engine.stop_all();
+}
+
+std::string MacroRecorder::optimize_macro(const std::string& macro_name) {
+    std::string filename = macros_dir + "/" + macro_name + ".macro";
+    MacroHeader header;
+    std::vector<MacroEvent> macro_events;
+
+    if (!utils::read_macro_file(filename, header, macro_events)) {
+        return "Error opening macro file: " + filename;
     }
 
-    std::cout << "Playback completed" << std::endl;
+    OptimizeOptions options = optimize_options;
+    options.enabled = true;
+    OptimizeStats stats = utils::optimize_macro(macro_events, options);
+
+    if (!utils::write_macro_file(filename, header, macro_events, compact_storage)) {
+        return "Error saving macro: " + filename;
+    }
+    cache.invalidate(filename);
+    index.update(macro_name);
+    return "Optimized " + macro_name + ": " + stats.summary();
+}
+
+bool MacroRecorder::prepare_playback() {
+    {
+        std::lock_guard<std::mutex> lock(uinput_mutex);
+        if (!uinput.initialize()) {
+            return false;
+        }
+    }
+    engine.warm_up();
+    return true;
 }
 
 void MacroRecorder::list_macros() const {
@@ -0,0 +1,122 @@
+#include "MacroWriter.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+MacroWriter::MacroWriter() : fd(-1), info{}, crc(0), last{} {}
+
+MacroWriter::~MacroWriter() {
+    discard();
+}
+
+bool MacroWriter::open(const std::string& filename, const MacroHeader& header) {
+    discard();
+
+    // The rename in finish() also keeps cached mappings of an older
+    // recording under the same name valid.
+    std::string temp = filename + ".tmp";
+    fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Error creating macro file");
+        return false;
+    }
+
+    path = filename;
+    tmp_path = temp;
+    info = MacroFileHeader{};
+    memcpy(info.magic, MACRO_MAGIC, sizeof(MACRO_MAGIC));
+    info.version = MACRO_VERSION;
+    info.encoding = MACRO_ENCODING_RAW;
+    info.start_x = header.start_x;
+    info.start_y = header.start_y;
+    info.header_size = sizeof(MacroFileHeader);
+    crc = 0;
+
+    if (!write_header() || lseek(fd, info.header_size, SEEK_SET) == -1) {
+        perror("Error writing macro header");
+        discard();
+        return false;
+    }
+    return true;
+}
+
+bool MacroWriter::append(const MacroEvent* events, size_t count) {
+    if (fd == -1) {
+        return false;
+    }
+
+    size_t bytes = count * sizeof(MacroEvent);
+    const char* data = reinterpret_cast<const char*>(events);
+    size_t written = 0;
+    while (written < bytes) {
+        ssize_t n = write(fd, data + written, bytes - written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error writing macro events");
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+
+    // Same boundaries as utils::frame_length: a new frame starts after a
+    // SYN_REPORT or whenever the timestamp changes.
+    for (size_t i = 0; i < count; i++) {
+        const MacroEvent& ev = events[i];
+        if (info.event_count == 0 || (last.type == EV_SYN && last.code == SYN_REPORT) ||
+            last.time_us != ev.time_us) {
+            info.frame_count++;
+        }
+        last = ev;
+        info.event_count++;
+    }
+
+    if (count > 0) {
+        info.duration_us = last.time_us;
+        crc = utils::checksum(events, bytes, crc);
+    }
+    return true;
+}
+
+bool MacroWriter::flush() {
+    if (fd == -1) {
+        return false;
+    }
+    return fdatasync(fd) == 0 && write_header() && fdatasync(fd) == 0;
+}
+
+bool MacroWriter::finish() {
+    if (fd == -1) {
+        return true;
+    }
+
+    bool ok = flush();
+    ok = close(fd) == 0 && ok;
+    fd = -1;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        perror("Error saving macro file");
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    if (!utils::sync_directory(path)) {
+        perror("Error syncing macro directory");
+    }
+    return true;
+}
+
+void MacroWriter::discard() {
+    if (fd == -1) {
+        return;
+    }
+    close(fd);
+    fd = -1;
+    unlink(tmp_path.c_str());
+}
+
+bool MacroWriter::write_header() {
+    info.checksum = crc;
+    return pwrite(fd, &info, sizeof(info), 0) == sizeof(info);
+}
@@ -0,0 +1,435 @@
+#include "PlaybackEngine.hpp"
+#include <chrono>
+
+PlaybackEngine::Playback::Playback(const PlaybackRequest& request, uint64_t id)
+    : macro(request.macro), cursor(std::make_unique<MacroCursor>(*request.macro)),
+      start_offset_us(request.start_offset_us), warp_cursor(request.warp_cursor), warp_pending(false),
+      lead_in(request.lead_in),
+      open(request.open), starved(false), step(Step::LoopStart), frame(nullptr), frame_size(0),
+      due_ns(0), loop_started_ns(0), stop_requested(false) {
+    info.id = id;
+    info.name = request.name;
+    info.sequence = request.sequence;
+    info.loop_count = request.loop_count;
+    stats = std::make_shared<PlaybackStats>();
+    stats->start(PlaybackScheduler::now_ns());
+    info.stats = stats;
+    clock.set_speed(request.speed);
+}
+
+PlaybackEngine::PlaybackEngine(EventSink& sink)
+    : sink(sink), spin_threshold_us(-1), running(false), active_playbacks(0), next_id(1), next_sequence(0),
+      dump_stopping(false) {}
+
+PlaybackEngine::~PlaybackEngine() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wakeup.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+
+    for (auto& entry : active) {
+        finish(*entry.second, PlaybackState::Stopped);
+    }
+    active.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(dump_mutex);
+        dump_stopping = true;
+    }
+    dump_ready.notify_all();
+    if (dump_worker.joinable()) {
+        dump_worker.join();
+    }
+}
+
+void PlaybackEngine::write_dumps() {
+    std::unique_lock<std::mutex> lock(dump_mutex);
+    while (true) {
+        dump_ready.wait(lock, [this]() {
+            return !dumps.empty() || dump_stopping;
+        });
+        if (dumps.empty()) {
+            return;
+        }
+        StatsDump dump = std::move(dumps.front());
+        dumps.pop_front();
+        lock.unlock();
+        dump.stats->write_json(dump.filename, dump.name, dump.now_ns, dump.id);
+        lock.lock();
+    }
+}
+
+void PlaybackEngine::warm_up() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running) {
+        running = true;
+        worker = std::thread(&PlaybackEngine::run, this);
+    }
+}
+
+uint64_t PlaybackEngine::start(const PlaybackRequest& request) {
+    if (!request.macro) {
+        return 0;
+    }
+    if (realtime.enabled) {
+        request.macro->prefault();
+    }
+
+    warm_up();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint64_t id = next_id++;
+    auto playback = std::make_unique<Playback>(request, id);
+    playback->due_ns = PlaybackScheduler::now_ns() + request.delay_us * 1000;
+    schedule(id, playback->due_ns);
+    active[id] = std::move(playback);
+    active_playbacks++;
+    wakeup.notify_all();
+    return id;
+}
+
+bool PlaybackEngine::append(uint64_t id, const PlaybackRequest& next) {
+    if (!next.macro) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = active.find(id);
+    if (it == active.end() || !it->second->open) {
+        return false;
+    }
+
+    Playback& playback = *it->second;
+    playback.queued.push_back(next);
+    if (playback.starved) {
+        // Arrived too late for a seamless handoff; carry on from now.
+        playback.starved = false;
+        playback.due_ns = PlaybackScheduler::now_ns();
+        schedule(id, playback.due_ns);
+        wakeup.notify_all();
+    }
+    return true;
+}
+
+void PlaybackEngine::seal(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = active.find(id);
+    if (it == active.end()) {
+        return;
+    }
+
+    it->second->open = false;
+    if (it->second->starved) {
+        it->second->starved = false;
+        schedule(id, PlaybackScheduler::now_ns());
+        wakeup.notify_all();
+    }
+}
+
+bool PlaybackEngine::wait_drained(uint64_t id) {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool ended = false;
+    drained.wait(lock, [&]() {
+        auto it = active.find(id);
+        PlaybackState state = it == active.end() ? PlaybackState::Finished : it->second->info.state;
+        ended = state == PlaybackState::Finished || state == PlaybackState::Stopped;
+        return ended || it->second->queued.empty();
+    });
+    return !ended;
+}
+
+void PlaybackEngine::set_stats_directory(const std::string& dir) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats_dir = dir;
+}
+
+void PlaybackEngine::set_progress_callback(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    on_progress = callback;
+}
+
+bool PlaybackEngine::stop(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = active.find(id);
+    if (it == active.end()) {
+        return false;
+    }
+
+    it->second->stop_requested = true;
+    schedule(id, PlaybackScheduler::now_ns());
+    wakeup.notify_all();
+    return true;
+}
+
+void PlaybackEngine::stop_all() {
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t now = PlaybackScheduler::now_ns();
+    for (auto& entry : active) {
+        entry.second->stop_requested = true;
+        schedule(entry.first, now);
+    }
+    wakeup.notify_all();
+}
+
+bool PlaybackEngine::status(uint64_t id, PlaybackStatus& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = active.find(id);
+    if (it != active.end()) {
+        out = it->second->info;
+        return true;
+    }
+
+    for (const auto& info : finished) {
+        if (info.id == id) {
+            out = info;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<PlaybackStatus> PlaybackEngine::list() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<PlaybackStatus> result;
+    for (const auto& entry : active) {
+        result.push_back(entry.second->info);
+    }
+    result.insert(result.end(), finished.begin(), finished.end());
+    return result;
+}
+
+void PlaybackEngine::schedule(uint64_t id, int64_t time_ns) {
+    deadlines.push({time_ns, next_sequence++, id});
+}
+
+void PlaybackEngine::run() {
+    utils::enter_realtime(realtime);
+
+    PlaybackScheduler calibration;
+    int64_t spin_ns = spin_threshold_us < 0 ? calibration.calibrate() : spin_threshold_us * 1000LL;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        if (deadlines.empty()) {
+            wakeup.wait(lock);
+            continue;
+        }
+
+        Deadline next = deadlines.top();
+        if (next.time_ns - PlaybackScheduler::now_ns() > spin_ns) {
+            // steady_clock is CLOCK_MONOTONIC, the same base as the deadlines.
+            auto wake = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(next.time_ns - spin_ns));
+            wakeup.wait_until(lock, wake);
+            continue;
+        }
+
+        deadlines.pop();
+        auto it = active.find(next.id);
+        if (it == active.end()) {
+            continue;
+        }
+
+        Playback& playback = *it->second;
+        if (!playback.stop_requested) {
+            // Only this thread erases playbacks, so the reference outlives the
+            // unlocked spin; start() and stop() stay responsive meanwhile.
+            lock.unlock();
+            PlaybackScheduler::spin_until(next.time_ns);
+            lock.lock();
+            if (!running) {
+                break;
+            }
+        }
+
+        if (playback.stop_requested) {
+            finish(playback, PlaybackState::Stopped);
+            active.erase(next.id);
+            continue;
+        }
+
+        int64_t now_ns = PlaybackScheduler::now_ns();
+        advance(playback, now_ns);
+        if (playback.warp_pending) {
+            // An X round trip, or an xdotool fork, must not hold up start()
+            // and stop(). The loop is timed from before the warp as it was.
+            playback.warp_pending = false;
+            lock.unlock();
+            utils::set_cursor_position(playback.macro->start_x(), playback.macro->start_y());
+            lock.lock();
+            start_loop(playback, now_ns);
+        }
+        if (playback.info.state == PlaybackState::Finished) {
+            active.erase(next.id);
+        }
+    }
+}
+
+void PlaybackEngine::advance(Playback& playback, int64_t now_ns) {
+    if (playback.step == Step::LoopStart) {
+        begin_loop(playback, now_ns);
+        return;
+    }
+
+    playback.stats->record_frame(now_ns - playback.due_ns, playback.frame_size);
+    playback.stats->record_writes(sink.emit_frame(playback.frame, playback.frame_size, playback.due_ns));
+    utils::apply_key_events(playback.held, playback.frame, playback.frame_size);
+    playback.info.frames_emitted++;
+    if (on_progress) {
+        on_progress();
+    }
+
+    size_t count;
+    const MacroEvent* frame = playback.cursor->next_frame(count);
+    if (frame) {
+        playback.frame = frame;
+        playback.frame_size = count;
+        playback.due_ns = playback.clock.deadline(frame->time_us * 1000);
+        schedule(playback.info.id, playback.due_ns);
+        return;
+    }
+
+    playback.stats->record_loop(now_ns - playback.loop_started_ns);
+    playback.step = Step::LoopStart;
+
+    // After its last loop a segment hands over to the next one on the spot,
+    // measured from when this frame was due rather than when it went out.
+    const PlaybackStatus& info = playback.info;
+    bool last_loop = info.loop_count != -1 && info.current_loop >= info.loop_count;
+    bool handoff = last_loop && (playback.open || !playback.queued.empty());
+    schedule(info.id, handoff ? playback.due_ns : now_ns + LOOP_GAP_NS);
+}
+
+void PlaybackEngine::begin_loop(Playback& playback, int64_t now_ns) {
+    PlaybackStatus& info = playback.info;
+    if (info.loop_count != -1 && info.current_loop >= info.loop_count && !next_segment(playback)) {
+        if (playback.open) {
+            playback.starved = true;
+            return;
+        }
+        finish(playback, PlaybackState::Finished);
+        return;
+    }
+
+    info.current_loop++;
+    info.state = PlaybackState::Playing;
+    if (on_progress) {
+        on_progress();
+    }
+    if (playback.warp_cursor) {
+        playback.warp_pending = true;
+        return;
+    }
+    start_loop(playback, now_ns);
+}
+
+void PlaybackEngine::start_loop(Playback& playback, int64_t now_ns) {
+    PlaybackStatus& info = playback.info;
+
+    // Only the first loop resumes partway; keys held at that point are
+    // pressed first so the rest of the macro sees a consistent state.
+    // A later segment of a sequence keeps to the timeline of the one before.
+    int64_t loop_start = now_ns + LOOP_GAP_NS;
+    if (info.current_loop == 1 && !playback.lead_in) {
+        loop_start = info.segment > 1 ? playback.due_ns : now_ns;
+    }
+    playback.loop_started_ns = loop_start;
+    bool resume = info.current_loop == 1 && playback.start_offset_us > 0;
+    if (resume) {
+        playback.cursor->seek(playback.start_offset_us, playback.held);
+        utils::key_state_events(playback.held, 1, key_frame);
+        if (!key_frame.empty()) {
+            playback.stats->record_writes(sink.emit_frame(key_frame.data(), key_frame.size()));
+        }
+        playback.clock.start_at(loop_start, playback.start_offset_us * 1000);
+    } else {
+        playback.cursor->rewind();
+        playback.held.reset();
+        playback.clock.start_at(loop_start);
+    }
+
+    size_t count;
+    const MacroEvent* frame = playback.cursor->next_frame(count);
+    if (!frame) {
+        schedule(info.id, loop_start);
+        return;
+    }
+
+    playback.step = Step::Frame;
+    playback.frame = frame;
+    playback.frame_size = count;
+    // As before, a fresh loop emits its first frame right at loop start.
+    playback.due_ns = resume ? playback.clock.deadline(frame->time_us * 1000) : loop_start;
+    schedule(info.id, playback.due_ns);
+}
+
+bool PlaybackEngine::next_segment(Playback& playback) {
+    if (playback.queued.empty()) {
+        return false;
+    }
+    PlaybackRequest next = std::move(playback.queued.front());
+    playback.queued.pop_front();
+    drained.notify_all();
+
+    // Keys the last segment left down do not carry over.
+    utils::key_state_events(playback.held, 0, key_frame);
+    if (!key_frame.empty()) {
+        playback.stats->record_writes(sink.emit_frame(key_frame.data(), key_frame.size()));
+    }
+    playback.held.reset();
+
+    playback.macro = next.macro;
+    playback.cursor = std::make_unique<MacroCursor>(*next.macro);
+    playback.start_offset_us = next.start_offset_us;
+    playback.warp_cursor = next.warp_cursor;
+    playback.lead_in = false;
+    playback.clock.set_speed(next.speed);
+    playback.due_ns += next.delay_us * 1000;
+
+    PlaybackStatus& info = playback.info;
+    info.name = next.name;
+    info.loop_count = next.loop_count;
+    info.current_loop = 0;
+    info.segment++;
+    return true;
+}
+
+void PlaybackEngine::finish(Playback& playback, PlaybackState state) {
+    // Never leave keys down when playback ends or is cut short.
+    utils::key_state_events(playback.held, 0, key_frame);
+    if (!key_frame.empty()) {
+        playback.stats->record_writes(sink.emit_frame(key_frame.data(), key_frame.size()));
+    }
+    playback.held.reset();
+
+    int64_t now = PlaybackScheduler::now_ns();
+    playback.stats->stop(now);
+    playback.info.state = state;
+    drained.notify_all();
+    finished.push_front(playback.info);
+    active_playbacks--;
+    if (finished.size() > FINISHED_HISTORY) {
+        finished.pop_back();
+    }
+    if (on_progress) {
+        on_progress();
+    }
+
+    // The dump happens off the scheduler thread so other macros keep timing.
+    if (!stats_dir.empty()) {
+        const PlaybackStatus& info = playback.info;
+        std::string name = info.sequence.empty() ? info.name : info.sequence;
+        std::string filename = stats_dir + "/" + name + ".stats.json";
+        {
+            std::lock_guard<std::mutex> lock(dump_mutex);
+            dumps.push_back({playback.stats, filename, name, now, info.id});
+            if (!dump_worker.joinable()) {
+                dump_worker = std::thread(&PlaybackEngine::write_dumps, this);
+            }
+        }
+        dump_ready.notify_one();
+    }
+}
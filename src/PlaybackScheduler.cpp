@@ -0,0 +1,92 @@
+#include "PlaybackScheduler.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <vector>
+
+namespace {
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+}
+
+PlaybackScheduler::PlaybackScheduler()
+    : anchor(now_ns()), spin_threshold(DEFAULT_SPIN_NS), speed_factor(1.0) {}
+
+void PlaybackScheduler::start(int64_t offset_ns) {
+    start_at(now_ns(), offset_ns);
+}
+
+void PlaybackScheduler::start_at(int64_t time_ns, int64_t offset_ns) {
+    anchor = time_ns - scaled(offset_ns);
+}
+
+void PlaybackScheduler::set_speed(double factor) {
+    speed_factor = factor > 0.0 ? factor : 1.0;
+}
+
+int64_t PlaybackScheduler::scaled(int64_t offset_ns) const {
+    if (speed_factor == 1.0) {
+        return offset_ns;
+    }
+    return static_cast<int64_t>(static_cast<double>(offset_ns) / speed_factor);
+}
+
+int64_t PlaybackScheduler::now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+void PlaybackScheduler::sleep_until(int64_t deadline_ns) {
+    timespec ts;
+    ts.tv_sec = deadline_ns / 1000000000LL;
+    ts.tv_nsec = deadline_ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+}
+
+void PlaybackScheduler::spin_until(int64_t deadline_ns) {
+    while (now_ns() < deadline_ns) {
+        cpu_relax();
+    }
+}
+
+int64_t PlaybackScheduler::wait_until(int64_t offset_ns) {
+    int64_t target = deadline(offset_ns);
+    if (target - now_ns() > spin_threshold) {
+        sleep_until(target - spin_threshold);
+    }
+
+    spin_until(target);
+    return now_ns() - target;
+}
+
+void PlaybackScheduler::set_spin_threshold_ns(int64_t ns) {
+    spin_threshold = std::clamp<int64_t>(ns, 0, MAX_SPIN_NS);
+}
+
+int64_t PlaybackScheduler::calibrate() {
+    constexpr int SAMPLES = 32;
+    constexpr int64_t SLEEP_NS = 200000;
+
+    std::vector<int64_t> overshoot;
+    overshoot.reserve(SAMPLES);
+    for (int i = 0; i < SAMPLES; i++) {
+        int64_t deadline = now_ns() + SLEEP_NS;
+        sleep_until(deadline);
+        overshoot.push_back(now_ns() - deadline);
+    }
+
+    // Cover the 90th percentile wake-up overshoot with some headroom.
+    std::sort(overshoot.begin(), overshoot.end());
+    int64_t p90 = overshoot[SAMPLES * 9 / 10];
+    spin_threshold = std::clamp<int64_t>(p90 + p90 / 2, MIN_SPIN_NS, MAX_SPIN_NS);
+    return spin_threshold;
+}
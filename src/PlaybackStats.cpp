@@ -0,0 +1,150 @@
+#include "PlaybackStats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+LatencyHistogram::LatencyHistogram() : total(0), max_ns(0) {
+    for (auto& c : counts) {
+        c.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(int64_t ns) {
+    if (ns < 0) {
+        ns = 0;
+    }
+
+    size_t index = 0;
+    uint64_t value = static_cast<uint64_t>(ns);
+    while (value > 0 && index < BUCKETS - 1) {
+        value >>= 1;
+        index++;
+    }
+
+    counts[index].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+
+    int64_t current = max_ns.load(std::memory_order_relaxed);
+    while (ns > current && !max_ns.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {
+    }
+}
+
+int64_t LatencyHistogram::percentile(double quantile) const {
+    uint64_t samples = count();
+    if (samples == 0) {
+        return 0;
+    }
+
+    uint64_t target = static_cast<uint64_t>(quantile * samples);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += bucket(i);
+        if (seen > target) {
+            return i == 0 ? 0 : std::min<int64_t>(int64_t(1) << i, max());
+        }
+    }
+    return max();
+}
+
+PlaybackStats::PlaybackStats()
+    : frames(0), events(0), writes(0), loops(0), last_loop_ns(0),
+      min_loop_ns(std::numeric_limits<int64_t>::max()), max_loop_ns(0), started_ns(0), stopped_ns(0) {}
+
+void PlaybackStats::record_frame(int64_t lateness_ns, size_t event_count) {
+    lateness_histogram.record(lateness_ns);
+    frames.fetch_add(1, std::memory_order_relaxed);
+    events.fetch_add(event_count, std::memory_order_relaxed);
+}
+
+void PlaybackStats::record_writes(size_t count) {
+    writes.fetch_add(count, std::memory_order_relaxed);
+}
+
+void PlaybackStats::record_loop(int64_t duration_ns) {
+    loops.fetch_add(1, std::memory_order_relaxed);
+    last_loop_ns.store(duration_ns, std::memory_order_relaxed);
+    if (duration_ns < min_loop_ns.load(std::memory_order_relaxed)) {
+        min_loop_ns.store(duration_ns, std::memory_order_relaxed);
+    }
+    if (duration_ns > max_loop_ns.load(std::memory_order_relaxed)) {
+        max_loop_ns.store(duration_ns, std::memory_order_relaxed);
+    }
+}
+
+PlaybackStatsSnapshot PlaybackStats::snapshot(int64_t now_ns) const {
+    PlaybackStatsSnapshot s;
+    s.frames = frames.load(std::memory_order_relaxed);
+    s.events = events.load(std::memory_order_relaxed);
+    s.writes = writes.load(std::memory_order_relaxed);
+    s.loops = loops.load(std::memory_order_relaxed);
+    s.last_loop_ns = last_loop_ns.load(std::memory_order_relaxed);
+    s.p50_ns = lateness_histogram.percentile(0.5);
+    s.p99_ns = lateness_histogram.percentile(0.99);
+    s.max_ns = lateness_histogram.max();
+
+    int64_t started = started_ns.load(std::memory_order_relaxed);
+    int64_t stopped = stopped_ns.load(std::memory_order_relaxed);
+    int64_t end = stopped > 0 ? stopped : now_ns;
+    s.elapsed_s = started > 0 ? (end - started) / 1e9 : 0.0;
+    s.events_per_s = s.elapsed_s > 0 ? s.events / s.elapsed_s : 0.0;
+    return s;
+}
+
+std::string PlaybackStats::to_json(const std::string& name, int64_t now_ns) const {
+    PlaybackStatsSnapshot s = snapshot(now_ns);
+    int64_t min_loop = min_loop_ns.load(std::memory_order_relaxed);
+
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"macro\": \"";
+    for (char c : name) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+    out << "\",\n";
+    out << "  \"elapsed_s\": " << s.elapsed_s << ",\n";
+    out << "  \"frames\": " << s.frames << ",\n";
+    out << "  \"events\": " << s.events << ",\n";
+    out << "  \"writes\": " << s.writes << ",\n";
+    out << "  \"events_per_s\": " << s.events_per_s << ",\n";
+    out << "  \"loops\": " << s.loops << ",\n";
+    out << "  \"loop_ns\": {\"last\": " << s.last_loop_ns
+        << ", \"min\": " << (s.loops > 0 ? min_loop : 0)
+        << ", \"max\": " << max_loop_ns.load(std::memory_order_relaxed) << "},\n";
+    out << "  \"lateness_ns\": {\"p50\": " << s.p50_ns << ", \"p99\": " << s.p99_ns
+        << ", \"max\": " << s.max_ns << ", \"buckets\": [";
+
+    // Each bucket is [upper_bound_ns, count]; empty buckets are skipped.
+    bool first = true;
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+        uint64_t n = lateness_histogram.bucket(i);
+        if (n == 0) {
+            continue;
+        }
+        out << (first ? "" : ", ") << "[" << (i == 0 ? 0 : int64_t(1) << i) << ", " << n << "]";
+        first = false;
+    }
+    out << "]}\n}\n";
+    return out.str();
+}
+
+bool PlaybackStats::write_json(const std::string& filename, const std::string& name, int64_t now_ns,
+                               uint64_t tag) const {
+    // Written beside the target and renamed so readers never see half a file.
+    std::string temp = filename + "." + std::to_string(tag) + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        if (!out.is_open()) {
+            return false;
+        }
+        out << to_json(name, now_ns);
+        if (!out) {
+            return false;
+        }
+    }
+    return std::rename(temp.c_str(), filename.c_str()) == 0;
+}
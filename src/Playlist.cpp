@@ -0,0 +1,98 @@
+#include "Playlist.hpp"
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+bool parse_number(const std::string& text, double& out) {
+    char* end = nullptr;
+    errno = 0;
+    out = std::strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0' && errno == 0 && std::isfinite(out);
+}
+
+}
+
+bool Playlist::load(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    items.clear();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::vector<std::string> words = split_words(line);
+        if (words.empty()) {
+            continue;
+        }
+
+        PlaybackRequest entry;
+        entry.name = words[0];
+        entry.lead_in = false;
+        std::string error;
+        if (!valid_name(entry.name) || !parse_options(words, 1, entry, error)) {
+            std::cout << filename << ":" << line_number << ": ignoring entry, bad "
+                      << (error.empty() ? "name " + entry.name : "option " + error) << std::endl;
+            continue;
+        }
+        items.push_back(entry);
+    }
+    return true;
+}
+
+bool Playlist::parse_options(const std::vector<std::string>& words, size_t first, PlaybackRequest& request,
+                             std::string& error) {
+    for (size_t i = first; i < words.size(); i++) {
+        const std::string& option = words[i];
+        if (option == "nowarp") {
+            request.warp_cursor = false;
+            continue;
+        }
+
+        size_t eq = option.find('=');
+        std::string key = option.substr(0, eq);
+        double value;
+        if (eq == std::string::npos || !parse_number(option.substr(eq + 1), value)) {
+            error = option;
+            return false;
+        }
+
+        if (key == "loops" && value >= 0 && value <= INT_MAX && value == static_cast<int>(value)) {
+            // 0 is endless, as in the menu.
+            request.loop_count = value == 0 ? -1 : static_cast<int>(value);
+        } else if (key == "offset" && PlaybackRequest::valid_offset(value)) {
+            request.start_offset_us = static_cast<int64_t>(value * 1000000);
+        } else if (key == "speed" && PlaybackRequest::valid_speed(value)) {
+            request.speed = value;
+        } else if (key == "delay" && PlaybackRequest::valid_offset(value)) {
+            request.delay_us = static_cast<int64_t>(value * 1000000);
+        } else {
+            error = option;
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<std::string> Playlist::split_words(const std::string& line) {
+    std::vector<std::string> words;
+    std::istringstream stream(line);
+    std::string word;
+    while (stream >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+bool Playlist::valid_name(const std::string& name) {
+    return !name.empty() && name[0] != '.' && name.find('/') == std::string::npos;
+}
@@ -0,0 +1,77 @@
+#include "RealTime.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+namespace utils {
+
+bool enter_realtime(const RealTimeOptions& options) {
+    if (!options.enabled) {
+        return true;
+    }
+
+    bool ok = true;
+
+    if (prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0) == -1) {
+        std::cout << "Real-time: cannot reduce timer slack: " << strerror(errno) << std::endl;
+        ok = false;
+    }
+
+    if (options.lock_memory) {
+        static std::once_flag locked;
+        static bool lock_ok = true;
+        std::call_once(locked, [] {
+            if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+                std::cout << "Real-time: mlockall failed (" << strerror(errno)
+                          << "), raise RLIMIT_MEMLOCK or run with CAP_IPC_LOCK" << std::endl;
+                lock_ok = false;
+            }
+        });
+        ok = ok && lock_ok;
+    }
+
+    if (options.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(options.cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            std::cout << "Real-time: cannot pin to CPU " << options.cpu << ": " << strerror(err) << std::endl;
+            ok = false;
+        }
+    }
+
+    sched_param param{};
+    param.sched_priority = std::clamp(options.priority, sched_get_priority_min(SCHED_FIFO),
+                                      sched_get_priority_max(SCHED_FIFO));
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+        std::cout << "Real-time: SCHED_FIFO unavailable (" << strerror(err)
+                  << "), needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance" << std::endl;
+        ok = false;
+    }
+
+    return ok;
+}
+
+void prefault_memory(const void* data, size_t size) {
+    if (!data || size == 0) {
+        return;
+    }
+
+    const volatile char* bytes = static_cast<const volatile char*>(data);
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    for (size_t offset = 0; offset < size; offset += page) {
+        (void)bytes[offset];
+    }
+    (void)bytes[size - 1];
+}
+
+} // namespace utils
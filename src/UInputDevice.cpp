@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <cstring>
+#include <string>
+#include <dirent.h>
 #include <thread>
 #include <chrono>
 
@@ -14,15 +16,21 @@ UInputDevice::~UInputDevice() {
 }
 
 bool UInputDevice::initialize() {
-    fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (initialized) {
+        return true;
+    }
+
+    fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
     if (fd < 0) {
         perror("Error opening uinput device");
         return false;
     }
 
+    // Every key and button is advertised: a code the device lacks is
+    // silently dropped on replay, and these ioctls run once per device.
     ioctl(fd, UI_SET_EVBIT, EV_KEY);
-    for (int i = 0; i < KEY_MAX; i++) {
-        ioctl(fd, UI_SET_KEYBIT, i);
+    for (int code = 1; code <= KEY_MAX; code++) {
+        ioctl(fd, UI_SET_KEYBIT, code);
     }
 
     ioctl(fd, UI_SET_EVBIT, EV_REL);
@@ -30,38 +38,130 @@ bool UInputDevice::initialize() {
     ioctl(fd, UI_SET_RELBIT, REL_Y);
     ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
     ioctl(fd, UI_SET_RELBIT, REL_HWHEEL);
+#ifdef REL_WHEEL_HI_RES
+    ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+    ioctl(fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES);
+#endif
 
-    ioctl(fd, UI_SET_EVBIT, EV_KEY);
-    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
-    ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
-    ioctl(fd, UI_SET_KEYBIT, BTN_MIDDLE);
-
-    struct uinput_user_dev uidev;
-    memset(&uidev, 0, sizeof(uidev));
-    snprintf(uidev.name, UINPUT_MAX_NAME_SIZE, "virtual-macro-device");
-    uidev.id.bustype = BUS_USB;
-    uidev.id.vendor = 0x1;
-    uidev.id.product = 0x1;
-    uidev.id.version = 1;
+    if (!setup_device()) {
+        perror("Error configuring uinput device");
+        close(fd);
+        fd = -1;
+        return false;
+    }
 
-    write(fd, &uidev, sizeof(uidev));
-    ioctl(fd, UI_DEV_CREATE);
+    if (ioctl(fd, UI_DEV_CREATE) == -1) {
+        perror("Error creating uinput device");
+        close(fd);
+        fd = -1;
+        return false;
+    }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
     initialized = true;
+    if (!wait_until_ready(1000)) {
+        std::cout << "Warning: virtual device node did not appear in time" << std::endl;
+    }
     return true;
 }
 
+bool UInputDevice::setup_device() {
+    uinput_setup setup;
+    memset(&setup, 0, sizeof(setup));
+    snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "%s", DEVICE_NAME);
+    setup.id.bustype = BUS_USB;
+    setup.id.vendor = 0x1;
+    setup.id.product = 0x1;
+    setup.id.version = 1;
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) == 0) {
+        return true;
+    }
+
+    // Kernels before 4.5 only accept the legacy uinput_user_dev write.
+    uinput_user_dev uidev;
+    memset(&uidev, 0, sizeof(uidev));
+    memcpy(uidev.name, setup.name, UINPUT_MAX_NAME_SIZE);
+    uidev.id = setup.id;
+    return write(fd, &uidev, sizeof(uidev)) == sizeof(uidev);
+}
+
+bool UInputDevice::wait_until_ready(int timeout_ms) {
+    char sysname[64] = {0};
+    if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        return true;
+    }
+
+    std::string sys_dir = std::string("/sys/devices/virtual/input/") + sysname;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (DIR* dir = opendir(sys_dir.c_str())) {
+            while (dirent* entry = readdir(dir)) {
+                if (strncmp(entry->d_name, "event", 5) == 0) {
+                    devnode = std::string("/dev/input/") + entry->d_name;
+                    break;
+                }
+            }
+            closedir(dir);
+        }
+
+        if (!devnode.empty() && access(devnode.c_str(), F_OK) == 0) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return false;
+}
+
 void UInputDevice::emit_event(const input_event& ev) {
     if (initialized) {
         write(fd, &ev, sizeof(ev));
     }
 }
 
+size_t UInputDevice::emit_frame(const MacroEvent* events, size_t count, int64_t) {
+    if (!initialized || count == 0) {
+        return 0;
+    }
+
+    // Frames are a handful of events; unusually long ones are split.
+    input_event frame[MAX_FRAME_EVENTS + 1];
+    size_t n = 0;
+    size_t writes = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        input_event& ev = frame[n++];
+        memset(&ev.time, 0, sizeof(ev.time));
+        ev.type = events[i].type;
+        ev.code = events[i].code;
+        ev.value = events[i].value;
+
+        if (n == MAX_FRAME_EVENTS && i + 1 < count) {
+            writes += write(fd, frame, n * sizeof(input_event)) != -1 ? 1 : 0;
+            n = 0;
+        }
+    }
+
+    const MacroEvent& last = events[count - 1];
+    if (last.type != EV_SYN || last.code != SYN_REPORT) {
+        input_event& syn = frame[n++];
+        memset(&syn, 0, sizeof(syn));
+        syn.type = EV_SYN;
+        syn.code = SYN_REPORT;
+    }
+
+    writes += write(fd, frame, n * sizeof(input_event)) != -1 ? 1 : 0;
+    return writes;
+}
+
 void UInputDevice::destroy() {
     if (initialized) {
         ioctl(fd, UI_DEV_DESTROY);
         close(fd);
+        fd = -1;
+        devnode.clear();
         initialized = false;
     }
 }
\ No newline at end of file
@@ -1,116 +1,262 @@
 #include "MacroRecorder.hpp"
 #include "Interface.hpp"
 #include "utils.hpp"
+#include "Config.hpp"
+#include "DeviceRegistry.hpp"
+#include "ControlServer.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <iostream>
-#include <atomic>
-#include <thread>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/select.h>
+#include <sstream>
 #include <linux/input.h>
 
-std::atomic<bool> recording(false);
-std::atomic<bool> should_exit(false);
-std::atomic<bool> interface_active(true);
+// Hotkeys arrive through the recorder's input reactor, on its thread. The
+// daemon has no interface, so Esc only means something interactively.
+void handle_hotkeys(const input_event* events, size_t count, MacroRecorder& recorder, Interface* interface) {
+    for (size_t i = 0; i < count; i++) {
+        const input_event& ev = events[i];
+        if (ev.type != EV_KEY || ev.value != 1) {
+            continue;
+        }
+
+        // Handle F9 to stop recording (even when interface is active)
+        if (ev.code == KEY_F9 && recorder.is_recording()) {
+            recorder.stop_recording();
+        }
+
+        // F10 stops every playback; with grab_while_playing it is the only
+        // key that still gets through.
+        if (ev.code == KEY_F10) {
+            recorder.stop_all_playback();
+        }
 
-void keyboard_monitor(MacroRecorder& recorder, const std::string& keyboard_device) {
-    int kbd_fd = open(keyboard_device.c_str(), O_RDONLY | O_NONBLOCK);
-    if (kbd_fd == -1) {
-        perror("Error opening keyboard device");
-        return;
+        // Handle Esc to exit
+        if (ev.code == KEY_ESC && interface) {
+            recorder.stop_recording();
+            interface->request_exit();
+        }
     }
+}
 
-    while (!should_exit) {
-        input_event ev;
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(kbd_fd, &fds);
-
-        timeval timeout{0, 100000};
-        
-        if (select(kbd_fd + 1, &fds, nullptr, nullptr, &timeout) > 0 && FD_ISSET(kbd_fd, &fds)) {
-            if (read(kbd_fd, &ev, sizeof(ev)) == sizeof(ev) && ev.type == EV_KEY && ev.value == 1) {
-                
-                // Handle F9 to stop recording (even when interface is active)
-                if (ev.code == 67) { // F9
-                    if (recording) {
-                        recorder.stop_recording();
-                        recording = false;
-                        std::cout << "\nRecording stopped via F9" << std::endl;
-                    }
-                }
-                
-                // Handle Esc to exit
-                if (ev.code == 1) { // Esc
-                    should_exit = true;
-                    recorder.stop_recording();
-                    break;
-                }
-            }
+// "a, b,c" -> {"a", "b", "c"}; empty entries are dropped.
+std::vector<std::string> split_list(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        if (!item.empty()) {
+            items.push_back(item);
         }
-        
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
+    return items;
+}
 
-    close(kbd_fd);
+bool load_config(Config& config) {
+    std::vector<std::string> candidates;
+    if (const char* path = std::getenv("MACROWISE_CONFIG")) {
+        candidates.push_back(path);
+    }
+    candidates.push_back("config/defaults.conf");
+    candidates.push_back("/etc/macrowise/defaults.conf");
+
+    for (const auto& path : candidates) {
+        if (config.load(path)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-int main() {
-    // Initialize devices
-    std::string mouse_device = "/dev/input/event8";
-    std::string keyboard_device = "/dev/input/event2";
-    std::string macros_dir = "/macroses";
-    
-    fs::create_directories(macros_dir);
-    
-    MacroRecorder recorder(mouse_device, keyboard_device);
-    recorder.set_macros_directory(macros_dir);
-    
-    // Start keyboard monitoring thread
-    std::thread keyboard_thread(keyboard_monitor, std::ref(recorder), keyboard_device);
-    
+int run_interactive(MacroRecorder& recorder, const std::string& keyboard_device, DeviceRegistry& devices) {
     // Initialize interface
     Interface interface;
+
+    // The hotkeys share the recorder's reader; only F9, F10 and Esc are asked
+    // for here, the recorder widens the filter while it records.
+    InputReactor& input = recorder.input_reactor();
+    uint64_t hotkey_device = input.acquire(keyboard_device, DEVICE_KEYBOARD, 1u << EV_KEY, {KEY_F9, KEY_F10, KEY_ESC});
+    if (hotkey_device == 0) {
+        devices.print();
+    }
+    uint64_t hotkeys = input.subscribe([&](const input_event* events, size_t count) {
+        handle_hotkeys(events, count, recorder, &interface);
+    });
     
     // Set up callbacks
     interface.set_recording_callback([&](const std::string& name) {
-        recording = true;
-        std::thread([&, name]() {
-            recorder.start_recording(name);
-            recording = false;
-        }).detach();
+        recorder.begin_recording(name);
+    });
+
+    interface.set_recorded_events_callback([&]() {
+        return recorder.recorded_event_count();
+    });
+    
+    interface.set_playback_callback([&](const std::string& name, int loops, double start_at, double speed) {
+        // The menu offers 0 for endless playback; the engine spells that -1.
+        return recorder.play_macro(name, loops == 0 ? -1 : loops, start_at, speed);
+    });
+
+    interface.set_playlist_callback([&](const std::string& name, int loops) {
+        return recorder.play_playlist(name, loops == 0 ? -1 : loops, static_cast<int64_t>(recorder.start_delay_seconds()) * 1000000);
+    });
+
+    interface.set_playback_status_callback([&](uint64_t id, PlaybackStatus& status) {
+        return recorder.playback_engine().status(id, status);
+    });
+
+    interface.set_stop_playback_callback([&](uint64_t id) {
+        recorder.stop_playback(id);
     });
     
-    interface.set_playback_callback([&](const std::string& name, int loops) {
-        std::thread([&, name, loops]() {
-            recorder.play_macro(name, loops);
-        }).detach();
+    interface.set_list_callback([&](const std::string& filter, MacroSort sort, bool descending) {
+        MacroIndex& index = recorder.macro_index();
+        index.refresh();
+        return index.query(filter, sort, descending);
     });
     
-    interface.set_list_callback([&]() {
-        return utils::list_macros(macros_dir);
+    interface.set_optimize_callback([&](const std::string& name) {
+        return recorder.optimize_macro(name);
     });
     
     interface.set_stop_recording_callback([&]() {
-        if (recording) {
-            recorder.stop_recording();
-            recording = false;
-        }
+        recorder.stop_recording();
     });
     
     interface.set_recording_status_callback([&]() {
-        return recording.load();
+        return recorder.is_recording();
     });
     
+    recorder.set_progress_callback([&]() {
+        interface.notify();
+    });
+
     // Run the interface
     interface.run();
     
     // Cleanup
-    should_exit = true;
-    if (keyboard_thread.joinable()) {
-        keyboard_thread.join();
+    input.unsubscribe(hotkeys);
+    input.release(hotkey_device);
+    recorder.set_progress_callback(nullptr);
+    return 0;
+}
+
+int run_daemon(MacroRecorder& recorder, const std::string& keyboard_device, const Config& config,
+               const std::string& socket_path) {
+    ControlServer server(recorder);
+    mode_t mode = std::strtol(config.get("daemon", "socket_mode", "0600").c_str(), nullptr, 8);
+    if (!server.listen(socket_path, mode)) {
+        return 1;
+    }
+
+    // Everything a play request needs is set up here rather than on the
+    // first request: the cursor display connection and the listed macros.
+    int x, y;
+    utils::get_current_cursor_position(x, y);
+    for (const auto& name : split_list(config.get("daemon", "preload", ""))) {
+        if (!recorder.preload_macro(name)) {
+            std::cout << "Cannot preload macro: " << name << std::endl;
+        }
+    }
+
+    // F9 still ends a recording started over the socket, F10 the playbacks.
+    InputReactor& input = recorder.input_reactor();
+    uint64_t hotkey_device = input.acquire(keyboard_device, DEVICE_KEYBOARD, 1u << EV_KEY, {KEY_F9, KEY_F10});
+    uint64_t hotkeys = input.subscribe([&](const input_event* events, size_t count) {
+        handle_hotkeys(events, count, recorder, nullptr);
+    });
+
+    std::cout << "Listening on " << socket_path << std::endl;
+    server.run();
+
+    input.unsubscribe(hotkeys);
+    input.release(hotkey_device);
+    recorder.stop_recording();
+    recorder.stop_all_playback();
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool daemon = false;
+    std::string socket_path;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--daemon") {
+            daemon = true;
+        } else if (arg == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else {
+            std::cout << "Usage: " << argv[0] << " [--daemon [--socket PATH]]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Before any thread exists, so every thread inherits the mask.
+    if (daemon && !ControlServer::block_signals()) {
+        return 1;
+    }
+
+    Config config;
+    if (!load_config(config)) {
+        std::cout << "No configuration file found, using defaults" << std::endl;
+    }
+
+    std::string mouse_device = config.get("devices", "mouse_device", "auto");
+    std::string keyboard_device = config.get("devices", "keyboard_device", "auto");
+    std::string macros_dir = config.get("paths", "macros_directory", "/macroses");
+    if (socket_path.empty()) {
+        socket_path = config.get("daemon", "socket", "/run/macrowise.sock");
     }
     
+    fs::create_directories(macros_dir);
+
+    DeviceRegistry devices;
+    devices.set_cache_file(config.get("paths", "device_cache", macros_dir + "/.devices.cache"));
+    devices.scan();
+    if (config.get_bool("devices", "watch_hotplug", true)) {
+        devices.start_watching();
+    }
+
+    MacroRecorder recorder(mouse_device, keyboard_device);
+    recorder.set_device_registry(&devices);
+    for (const auto& device : split_list(config.get("devices", "extra_devices", ""))) {
+        recorder.add_input_device(device);
+    }
+    recorder.set_macros_directory(macros_dir);
+    recorder.set_start_delay(config.get_int("settings", "start_delay_seconds", 3));
+    recorder.set_exclusive_grab(config.get_bool("settings", "grab_while_recording", false));
+    recorder.set_playback_grab(config.get_bool("settings", "grab_while_playing", false));
+    recorder.set_compact_storage(config.get_bool("settings", "compact_storage", false));
+    recorder.set_spin_threshold_us(config.get_int("settings", "spin_threshold_us", -1));
+    recorder.set_cache_capacity(std::max(1, config.get_int("settings", "cache_capacity", 16)));
+
+    OptimizeOptions optimize;
+    optimize.enabled = config.get_bool("optimize", "enabled", optimize.enabled);
+    optimize.trim_idle = config.get_bool("optimize", "trim_idle", optimize.trim_idle);
+    optimize.max_idle_us = std::max(0, config.get_int("optimize", "max_idle_ms", 0)) * 1000LL;
+    recorder.set_optimize_options(optimize);
+
+    // Before prepare_playback(), which starts the engine thread.
+    RealTimeOptions realtime;
+    realtime.enabled = config.get_bool("realtime", "enabled", realtime.enabled);
+    realtime.priority = config.get_int("realtime", "priority", realtime.priority);
+    realtime.cpu = config.get_int("realtime", "cpu", realtime.cpu);
+    realtime.lock_memory = config.get_bool("realtime", "lock_memory", realtime.lock_memory);
+    recorder.set_realtime(realtime);
+
+    if (!recorder.prepare_playback() && daemon) {
+        std::cout << "Failed to create virtual input device" << std::endl;
+        devices.stop_watching();
+        return 1;
+    }
+
+    int result = daemon ? run_daemon(recorder, keyboard_device, config, socket_path)
+                        : run_interactive(recorder, keyboard_device, devices);
+    devices.stop_watching();
+
+    std::cout << "Macro cache: " << recorder.macro_cache().hits() << " hits, "
+              << recorder.macro_cache().misses() << " misses" << std::endl;
     std::cout << "Program terminated" << std::endl;
-    return 0;
-}
\ No newline at end of file
+    return result;
+}
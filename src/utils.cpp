@@ -1,4 +1,6 @@
 #include "utils.hpp"
+#include "MacroFile.hpp"
+#include "DeviceRegistry.hpp"
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -6,39 +8,142 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <linux/input.h>
+#include <cerrno>
 #include <cstdio>
 #include <sstream>
+#include <ctime>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <utility>
+#include <mutex>
+#include <X11/Xlib.h>
 
-namespace utils {
+namespace {
 
-void print_devices() {
-    std::cout << "Available devices:" << std::endl;
-    for (int i = 0; i < 32; i++) {
-        std::string path = "/dev/input/event" + std::to_string(i);
-        if (fs::exists(path)) {
-            int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
-            if (fd != -1) {
-                char name[256] = "Unknown";
-                ioctl(fd, EVIOCGNAME(sizeof(name)), name);
-                std::cout << "event" << i << ": " << name;
-                
-                // Проверка доступности для чтения
-                if (access(path.c_str(), R_OK) == 0) {
-                    std::cout << " (readable)";
-                } else {
-                    std::cout << " (NO READ ACCESS)";
-                }
-                std::cout << std::endl;
-                
-                close(fd);
+std::mutex display_mutex;
+
+// Opened once on first use and kept for the process lifetime; callers hold
+// display_mutex. nullptr when no X server is reachable.
+Display* cursor_display() {
+    static Display* display = XOpenDisplay(nullptr);
+    return display;
+}
+
+bool write_all(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
             }
+            return false;
         }
+        bytes += n;
+        size -= static_cast<size_t>(n);
     }
+    return true;
+}
+
+bool xdotool_available() {
+    static const bool available = system("which xdotool > /dev/null 2>&1") == 0;
+    return available;
+}
+
+// input_event with a 64-bit and a 32-bit timeval.
+constexpr size_t LEGACY_RECORD_SIZES[] = {24, 16};
+
+MacroEvent decode_legacy_event(const char* record, size_t record_size, int64_t& usec) {
+    int64_t sec;
+    if (record_size == 24) {
+        int64_t time[2];
+        memcpy(time, record, sizeof(time));
+        sec = time[0];
+        usec = time[1];
+    } else {
+        int32_t time[2];
+        memcpy(time, record, sizeof(time));
+        sec = time[0];
+        usec = time[1];
+    }
+
+    MacroEvent ev;
+    const char* tail = record + record_size - 8;
+    memcpy(&ev.type, tail, sizeof(ev.type));
+    memcpy(&ev.code, tail + 2, sizeof(ev.code));
+    memcpy(&ev.value, tail + 4, sizeof(ev.value));
+    ev.time_us = sec * 1000000 + usec;
+    return ev;
+}
+
+// Picks the record size whose leading records decode as plausible events:
+// times relative to the recording start, rising, with known event types.
+size_t legacy_record_size(const char* data, size_t size) {
+    constexpr size_t SAMPLE = 512;
+
+    size_t best = sizeof(input_event);
+    double best_score = -1;
+    for (size_t record_size : LEGACY_RECORD_SIZES) {
+        size_t count = std::min(size / record_size, SAMPLE);
+        size_t plausible = 0;
+        int64_t previous = 0;
+        for (size_t i = 0; i < count; i++) {
+            int64_t usec;
+            MacroEvent ev = decode_legacy_event(data + i * record_size, record_size, usec);
+            if (usec >= 0 && usec < 1000000 && ev.time_us >= previous && ev.time_us < 1000000LL * 86400 * 365 &&
+                ev.type <= EV_MAX) {
+                plausible++;
+                previous = ev.time_us;
+            }
+        }
+
+        // Even division breaks ties, then the native layout.
+        double score = count == 0 ? 0 : static_cast<double>(plausible) / count;
+        score += size % record_size == 0 ? 0.001 : 0;
+        score += record_size == sizeof(input_event) ? 0.0001 : 0;
+        if (score > best_score) {
+            best = record_size;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+}
+
+namespace utils {
+
+void print_devices() {
+    DeviceRegistry registry;
+    registry.scan();
+    registry.print();
+}
+
+timeval monotonic_time() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timeval{ts.tv_sec, ts.tv_nsec / 1000};
 }
 
 int get_current_cursor_position(int& x, int& y) {
-    // Check if xdotool is available
-    if (system("which xdotool > /dev/null 2>&1") != 0) {
+    {
+        std::lock_guard<std::mutex> lock(display_mutex);
+        if (Display* display = cursor_display()) {
+            Window root, child;
+            int root_x, root_y, win_x, win_y;
+            unsigned int mask;
+            if (XQueryPointer(display, DefaultRootWindow(display), &root, &child,
+                              &root_x, &root_y, &win_x, &win_y, &mask)) {
+                x = root_x;
+                y = root_y;
+                return 0;
+            }
+        }
+    }
+
+    if (!xdotool_available()) {
         x = 960;
         y = 540;
         return -1;
@@ -62,9 +167,20 @@ int get_current_cursor_position(int& x, int& y) {
 }
 
 void set_cursor_position(int x, int y) {
-    // Check if xdotool is available
-    if (system("which xdotool > /dev/null 2>&1") != 0) {
-        std::cout << "Warning: xdotool not available, cannot set cursor position" << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(display_mutex);
+        if (Display* display = cursor_display()) {
+            XWarpPointer(display, None, DefaultRootWindow(display), 0, 0, 0, 0, x, y);
+            XSync(display, False);
+            return;
+        }
+    }
+
+    if (!xdotool_available()) {
+        static std::once_flag warned;
+        std::call_once(warned, [] {
+            std::cout << "Warning: neither X11 nor xdotool available, cannot set cursor position" << std::endl;
+        });
         return;
     }
 
@@ -115,31 +231,221 @@ std::vector<std::string> list_macros(const std::string& macros_dir) {
     return macros;
 }
 
-bool read_macro_file(const std::string& filename, MacroHeader& header, std::vector<input_event>& events) {
-    std::ifstream in(filename, std::ios::binary);
+// A frame runs up to and including SYN_REPORT. Events recorded without a
+// SYN_REPORT (filtered keyboard streams) end their frame when the timestamp
+// changes, so they are never held back until the next mouse report.
+size_t frame_length(const MacroEvent* events, size_t count) {
+    size_t n = 0;
+    while (n < count) {
+        const MacroEvent& ev = events[n];
+        if (n > 0 && ev.time_us != events[0].time_us) {
+            break;
+        }
+        n++;
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+            break;
+        }
+    }
+    return n;
+}
+
+size_t count_frames(const MacroEvent* events, size_t count) {
+    size_t frames = 0;
+    for (size_t i = 0; i < count; i += frame_length(events + i, count - i)) {
+        frames++;
+    }
+    return frames;
+}
+
+void apply_key_events(KeyState& keys, const MacroEvent* events, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const MacroEvent& ev = events[i];
+        if (ev.type == EV_KEY && ev.code < KEY_CNT && ev.value != 2) {
+            keys.set(ev.code, ev.value != 0);
+        }
+    }
+}
+
+// One EV_KEY event per set bit with the given value, e.g. 0 to release them all.
+void key_state_events(const KeyState& keys, int32_t value, std::vector<MacroEvent>& out) {
+    out.clear();
+    for (size_t code = 0; code < keys.size(); code++) {
+        if (keys.test(code)) {
+            out.push_back({0, EV_KEY, static_cast<uint16_t>(code), value});
+        }
+    }
+}
+
+// CRC32; pass the previous result to continue a running checksum.
+uint32_t checksum(const void* data, size_t size, uint32_t previous) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    uint32_t crc = previous ^ 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+bool read_macro_file(const std::string& filename, MacroHeader& header, std::vector<MacroEvent>& events) {
+    MacroFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    header.start_x = file.start_x();
+    header.start_y = file.start_y();
+    events.clear();
+    events.reserve(file.size());
+
+    MacroCursor cursor(file);
+    size_t count;
+    while (const MacroEvent* frame = cursor.next_frame(count)) {
+        events.insert(events.end(), frame, frame + count);
+    }
+    return true;
+}
+
+// Pre-versioned layout: a raw MacroHeader followed by input_event structs
+// as laid out on the machine that recorded them.
+bool read_legacy_macro_file(const std::string& filename, MacroHeader& header, std::vector<MacroEvent>& events,
+                            LegacyLayout* layout) {
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
     if (!in) {
         return false;
     }
+    std::vector<char> data(static_cast<size_t>(std::max<std::streamoff>(in.tellg(), 0)));
+    in.seekg(0);
+    if (!in.read(data.data(), data.size()) || data.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    const char* records = data.data() + sizeof(header);
+    size_t size = data.size() - sizeof(header);
+    size_t record_size = legacy_record_size(records, size);
+    size_t count = size / record_size;
+
+    events.clear();
+    events.reserve(count);
+    int64_t usec;
+    for (size_t i = 0; i < count; i++) {
+        events.push_back(decode_legacy_event(records + i * record_size, record_size, usec));
+    }
 
-    in.read(reinterpret_cast<char*>(&header), sizeof(header));
-    input_event ev;
-    while (in.read(reinterpret_cast<char*>(&ev), sizeof(ev))) {
-        events.push_back(ev);
+    if (layout) {
+        layout->record_size = record_size;
+        layout->trailing_bytes = size % record_size;
     }
-    
     return true;
 }
 
-bool write_macro_file(const std::string& filename, const MacroHeader& header, const std::vector<input_event>& events) {
-    std::ofstream out(filename, std::ios::binary);
-    if (!out.is_open()) {
+// Written next to the target, synced and renamed, so a crash leaves either
+// the old file or the new one, never a torn or empty one.
+bool write_parts_atomic(const std::string& filename, std::initializer_list<std::pair<const void*, size_t>> parts) {
+    std::string tmp_name = filename + ".tmp";
+    int fd = open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
         return false;
     }
 
-    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    out.write(reinterpret_cast<const char*>(events.data()), events.size() * sizeof(input_event));
-    
+    bool ok = true;
+    for (const auto& part : parts) {
+        ok = ok && write_all(fd, part.first, part.second);
+    }
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp_name.c_str(), filename.c_str()) != 0) {
+        unlink(tmp_name.c_str());
+        return false;
+    }
+    if (!utils::sync_directory(filename)) {
+        perror(("Error syncing the directory of " + filename).c_str());
+    }
     return true;
 }
 
+}
+
+namespace utils {
+
+// Makes a rename of filename durable.
+bool sync_directory(const std::string& filename) {
+    std::string dir = fs::path(filename).parent_path().string();
+    int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+bool write_macro_file(const std::string& filename, const MacroHeader& header, const std::vector<MacroEvent>& events,
+                      bool compact) {
+    std::vector<uint8_t> encoded;
+    const void* payload = events.data();
+    size_t payload_size = events.size() * sizeof(MacroEvent);
+    if (compact) {
+        encode_compact(events, encoded);
+        payload = encoded.data();
+        payload_size = encoded.size();
+    }
+
+    MacroFileHeader file_header{};
+    memcpy(file_header.magic, MACRO_MAGIC, sizeof(MACRO_MAGIC));
+    file_header.version = MACRO_VERSION;
+    file_header.encoding = compact ? MACRO_ENCODING_COMPACT : MACRO_ENCODING_RAW;
+    file_header.start_x = header.start_x;
+    file_header.start_y = header.start_y;
+    file_header.event_count = events.size();
+    file_header.frame_count = count_frames(events.data(), events.size());
+    file_header.duration_us = events.empty() ? 0 : events.back().time_us;
+    file_header.checksum = checksum(payload, payload_size);
+    file_header.header_size = sizeof(MacroFileHeader);
+
+    return write_parts_atomic(filename, {{&file_header, sizeof(file_header)}, {payload, payload_size}});
+}
+
+bool write_file_atomic(const std::string& filename, const std::string& contents) {
+    return write_parts_atomic(filename, {{contents.data(), contents.size()}});
+}
+
+std::vector<std::vector<std::string>> read_tab_records(const std::string& filename, size_t field_count) {
+    std::vector<std::vector<std::string>> records;
+    std::ifstream in(filename);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        // Split by hand: getline() would drop an empty trailing field.
+        std::vector<std::string> fields;
+        size_t begin = 0;
+        while (true) {
+            size_t tab = line.find('\t', begin);
+            fields.push_back(line.substr(begin, tab - begin));
+            if (tab == std::string::npos) {
+                break;
+            }
+            begin = tab + 1;
+        }
+        if (fields.size() == field_count) {
+            records.push_back(std::move(fields));
+        }
+    }
+    return records;
+}
+
 } // namespace utils
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "MacroCodec.hpp"
+#include "MacroFile.hpp"
+#include <climits>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+
+// Round-trips event streams through the compact .macro encoding: the
+// codec on its own, then a whole file through write_macro_file and
+// MacroFile. Exits non-zero on the first mismatch.
+
+namespace {
+
+bool same(const MacroEvent& a, const MacroEvent& b) {
+    return a.time_us == b.time_us && a.type == b.type && a.code == b.code && a.value == b.value;
+}
+
+bool check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cout << "FAIL: " << what << std::endl;
+    }
+    return ok;
+}
+
+std::vector<MacroEvent> random_events(std::mt19937_64& rng, size_t count) {
+    std::vector<MacroEvent> events;
+    int64_t time = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Mostly small steps, sometimes long pauses and backwards jumps.
+        switch (rng() % 8) {
+            case 0: time += static_cast<int64_t>(rng() % 100000000); break;
+            case 1: time -= static_cast<int64_t>(rng() % 1000); break;
+            default: time += static_cast<int64_t>(rng() % 20000); break;
+        }
+        int32_t value;
+        switch (rng() % 4) {
+            case 0: value = INT32_MIN + static_cast<int32_t>(rng() % 2); break;
+            case 1: value = INT32_MAX - static_cast<int32_t>(rng() % 2); break;
+            default: value = static_cast<int32_t>(rng() % 201) - 100; break;
+        }
+        events.push_back({time, static_cast<uint16_t>(rng() % (EV_MAX + 1)),
+                          static_cast<uint16_t>(rng() % (rng() % 2 ? 0x10000 : 8)), value});
+    }
+    return events;
+}
+
+bool decode(const std::vector<uint8_t>& encoded, std::vector<MacroEvent>& out) {
+    std::vector<EventKey> dictionary;
+    size_t consumed = 0;
+    if (!utils::decode_dictionary(encoded.data(), encoded.size(), dictionary, consumed)) {
+        return false;
+    }
+    CompactDecoder decoder;
+    decoder.reset(encoded.data() + consumed, encoded.size() - consumed, &dictionary);
+    out.clear();
+    MacroEvent ev;
+    while (decoder.next(ev)) {
+        out.push_back(ev);
+    }
+    return decoder.offset() == encoded.size() - consumed;
+}
+
+bool codec_round_trip(const std::vector<MacroEvent>& events) {
+    std::vector<uint8_t> encoded;
+    utils::encode_compact(events, encoded);
+
+    std::vector<MacroEvent> decoded;
+    if (!check(decode(encoded, decoded), "stream did not decode to its end") ||
+        !check(decoded.size() == events.size(), "decoded " + std::to_string(decoded.size()) + " of " +
+                                                    std::to_string(events.size()) + " events")) {
+        return false;
+    }
+    for (size_t i = 0; i < events.size(); i++) {
+        if (!check(same(events[i], decoded[i]), "event " + std::to_string(i) + " differs")) {
+            return false;
+        }
+    }
+
+    // A truncated stream must stop short, never read past its end.
+    if (!encoded.empty()) {
+        encoded.pop_back();
+        decode(encoded, decoded);
+        if (!check(decoded.size() < events.size() || events.empty(), "truncated stream decoded in full")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool file_round_trip(const std::vector<MacroEvent>& events, const std::string& filename) {
+    if (!check(utils::write_macro_file(filename, MacroHeader{12, -34}, events, true), "cannot write " + filename)) {
+        return false;
+    }
+
+    MacroFile file;
+    bool ok = check(file.open(filename, true), "cannot open " + filename) &&
+              check(file.is_compact(), "file is not compact") &&
+              check(file.size() == events.size(), "header event count") &&
+              check(file.start_x() == 12 && file.start_y() == -34, "start position");
+
+    size_t i = 0;
+    MacroCursor cursor(file);
+    size_t count;
+    while (ok && (i < events.size() || events.empty())) {
+        const MacroEvent* frame = cursor.next_frame(count);
+        if (!frame) {
+            break;
+        }
+        for (size_t j = 0; ok && j < count; j++, i++) {
+            ok = check(i < events.size() && same(frame[j], events[i]), "file event " + std::to_string(i));
+        }
+    }
+    ok = ok && check(i == events.size(), "file ended early");
+    unlink(filename.c_str());
+    return ok;
+}
+
+}
+
+int main() {
+    std::mt19937_64 rng(20240611);
+    std::string filename = "codec_roundtrip_" + std::to_string(getpid()) + ".macro";
+
+    bool ok = codec_round_trip({}) && file_round_trip({}, filename);
+    for (size_t count : {1, 2, 63, 64, 65, 1000, 50000}) {
+        std::vector<MacroEvent> events = random_events(rng, count);
+        ok = ok && codec_round_trip(events) && file_round_trip(events, filename);
+    }
+
+    // Extremes of every field in a single stream.
+    std::vector<MacroEvent> extremes = {
+        {0, 0, 0, 0},
+        {INT64_MAX / 2, EV_MAX, 0xFFFF, INT32_MAX},
+        {-(INT64_MAX / 2), EV_KEY, KEY_MAX, INT32_MIN},
+        {0, EV_SYN, SYN_REPORT, 0},
+    };
+    ok = ok && codec_round_trip(extremes);
+
+    std::cout << (ok ? "codec round trip passed" : "codec round trip failed") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Sends requests to "MacroWise --daemon" and prints the replies. The
+// arguments form one request; without any, requests are read from stdin,
+// one per line. Exits non-zero if any reply is an error.
+//
+//   MacroWiseCtl play farm loops=10
+//   MacroWiseCtl --time ping
+
+namespace {
+
+const char* DEFAULT_SOCKET = "/run/macrowise.sock";
+
+int connect_socket(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Error creating socket");
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror(("Error connecting to " + path).c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool read_line(int fd, std::string& pending, std::string& line) {
+    char buffer[4096];
+    size_t newline;
+    while ((newline = pending.find('\n')) == std::string::npos) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            return false;
+        }
+        pending.append(buffer, n);
+    }
+    line = pending.substr(0, newline);
+    pending.erase(0, newline + 1);
+    return true;
+}
+
+// Returns false on a transport failure or an "ERR" reply.
+bool request(int fd, std::string& pending, const std::string& line, bool show_time) {
+    std::string message = line + "\n";
+    auto sent = std::chrono::steady_clock::now();
+    if (send(fd, message.data(), message.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(message.size())) {
+        perror("Error sending request");
+        return false;
+    }
+
+    std::string reply;
+    if (!read_line(fd, pending, reply)) {
+        std::cerr << "Connection closed by daemon" << std::endl;
+        return false;
+    }
+    auto received = std::chrono::steady_clock::now();
+
+    std::cout << reply;
+    if (show_time) {
+        std::cout << " (" << std::chrono::duration_cast<std::chrono::microseconds>(received - sent).count() << " us)";
+    }
+    std::cout << std::endl;
+    return reply.compare(0, 2, "OK") == 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string socket_path = DEFAULT_SOCKET;
+    if (const char* path = std::getenv("MACROWISE_SOCKET")) {
+        socket_path = path;
+    }
+
+    bool show_time = false;
+    std::string line;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (arg == "--time") {
+            show_time = true;
+        } else if (arg == "--help") {
+            std::cout << "Usage: " << argv[0] << " [--socket PATH] [--time] [REQUEST...]" << std::endl;
+            return 0;
+        } else {
+            line += (line.empty() ? "" : " ") + arg;
+        }
+    }
+
+    int fd = connect_socket(socket_path);
+    if (fd < 0) {
+        return 2;
+    }
+
+    std::string pending;
+    bool ok = true;
+    if (!line.empty()) {
+        ok = request(fd, pending, line, show_time);
+    } else {
+        while (std::getline(std::cin, line)) {
+            if (!line.empty() && !request(fd, pending, line, show_time)) {
+                ok = false;
+            }
+        }
+    }
+
+    close(fd);
+    return ok ? 0 : 1;
+}
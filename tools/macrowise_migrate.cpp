@@ -0,0 +1,342 @@
+#include "MacroFile.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Validates every .macro under the given paths on a pool of threads and,
+// with --rewrite, migrates them in place to the current versioned format.
+// Rewrites go through utils::write_macro_file, which renames a finished
+// temporary over the original, so an interrupted run never tears a file.
+//
+//   MacroWiseMigrate /macroses                     report only
+//   MacroWiseMigrate --rewrite --compact /archive  migrate and compact
+
+namespace {
+
+enum class Encoding {
+    Keep,
+    Raw,
+    Compact,
+};
+
+struct Options {
+    bool rewrite = false;
+    Encoding encoding = Encoding::Keep;
+    bool verbose = false;
+    unsigned jobs = 0;
+    std::vector<std::string> paths;
+};
+
+struct Report {
+    std::string format;
+    std::vector<std::string> problems;
+    // Worth reporting, but left as they are.
+    std::vector<std::string> notes;
+    bool readable = false;
+    // The file itself is damaged in a way a rewrite repairs.
+    bool damaged = false;
+    bool rewritten = false;
+    uint64_t bytes = 0;
+    uint64_t events = 0;
+};
+
+struct Totals {
+    std::atomic<size_t> files{0};
+    std::atomic<size_t> clean{0};
+    std::atomic<size_t> with_problems{0};
+    std::atomic<size_t> unreadable{0};
+    std::atomic<size_t> rewritten{0};
+    std::atomic<size_t> unresolved{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> events{0};
+};
+
+std::string describe(size_t count, const char* what) {
+    return std::to_string(count) + " " + what;
+}
+
+bool is_versioned(const std::string& filename) {
+    char magic[sizeof(MACRO_MAGIC)];
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool versioned = read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, MACRO_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+    return versioned;
+}
+
+// Loads the events of either format, noting anything wrong with the file
+// itself. Returns false when nothing usable could be read.
+bool load(const std::string& filename, MacroHeader& header, std::vector<MacroEvent>& events, Report& report) {
+    if (!is_versioned(filename)) {
+        LegacyLayout layout;
+        if (!utils::read_legacy_macro_file(filename, header, events, &layout)) {
+            report.problems.push_back("shorter than a macro header");
+            return false;
+        }
+        report.format = layout.record_size == sizeof(input_event) ? "legacy" : "legacy-" +
+                        std::to_string(layout.record_size) + "-byte-events";
+        if (layout.record_size != sizeof(input_event)) {
+            report.problems.push_back("32-bit event layout");
+        }
+        if (layout.trailing_bytes > 0) {
+            report.problems.push_back("truncated, " + describe(layout.trailing_bytes, "trailing bytes"));
+            report.damaged = true;
+        }
+        return true;
+    }
+
+    MacroFile file;
+    if (!file.open(filename, true)) {
+        if (!file.open(filename)) {
+            report.problems.push_back("corrupt or unsupported header");
+            return false;
+        }
+        report.problems.push_back("checksum mismatch");
+        report.damaged = true;
+    }
+    report.format = file.is_compact() ? "compact" : "raw";
+    return utils::read_macro_file(filename, header, events);
+}
+
+// Checks the event stream and repairs it in place: timestamps are clamped
+// so they never go back, unknown event types are dropped and keys still
+// down at the end are released, as playback itself does.
+bool check_events(std::vector<MacroEvent>& events, Report& report) {
+    size_t backwards = 0;
+    size_t invalid = 0;
+    size_t stray_releases = 0;
+    KeyState held;
+    int64_t previous = 0;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        MacroEvent ev = events[i];
+        if (ev.type > EV_MAX || (ev.type == EV_KEY && ev.code >= KEY_CNT)) {
+            invalid++;
+            continue;
+        }
+        if (ev.time_us < previous) {
+            backwards++;
+            ev.time_us = previous;
+        }
+        previous = ev.time_us;
+
+        if (ev.type == EV_KEY && ev.value == 0 && !held.test(ev.code)) {
+            stray_releases++;
+        }
+        utils::apply_key_events(held, &ev, 1);
+        events[kept++] = ev;
+    }
+    events.resize(kept);
+
+    if (backwards > 0) {
+        report.problems.push_back(describe(backwards, "timestamps go backwards"));
+    }
+    if (invalid > 0) {
+        report.problems.push_back(describe(invalid, "events with an invalid type or code"));
+    }
+    // A key held when recording started is released without a press;
+    // replaying that is harmless, so it is only noted.
+    if (stray_releases > 0) {
+        report.notes.push_back(describe(stray_releases, "key releases without a press"));
+    }
+    if (held.any()) {
+        report.problems.push_back(describe(held.count(), "keys still pressed at the end"));
+        std::vector<MacroEvent> releases;
+        utils::key_state_events(held, 0, releases);
+        for (auto& ev : releases) {
+            ev.time_us = previous;
+        }
+        releases.push_back({previous, EV_SYN, SYN_REPORT, 0});
+        events.insert(events.end(), releases.begin(), releases.end());
+    }
+
+    return backwards > 0 || invalid > 0 || held.any();
+}
+
+Report process(const std::string& filename, const Options& options) {
+    Report report;
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0) {
+        report.bytes = static_cast<uint64_t>(st.st_size);
+    }
+
+    MacroHeader header{};
+    std::vector<MacroEvent> events;
+    if (!load(filename, header, events, report)) {
+        return report;
+    }
+    report.readable = true;
+    if (events.empty()) {
+        report.notes.push_back("no events");
+    }
+
+    bool repaired = check_events(events, report);
+    report.events = events.size();
+    if (!options.rewrite) {
+        return report;
+    }
+
+    bool compact = options.encoding == Encoding::Compact ||
+                   (options.encoding == Encoding::Keep && report.format == "compact");
+    bool converted = report.format != (compact ? "compact" : "raw");
+    if (repaired || converted || report.damaged) {
+        report.rewritten = utils::write_macro_file(filename, header, events, compact);
+        if (!report.rewritten) {
+            report.problems.push_back("rewrite failed");
+        }
+    }
+    return report;
+}
+
+std::vector<std::string> collect(const std::vector<std::string>& paths) {
+    std::vector<std::string> files;
+    for (const auto& path : paths) {
+        std::error_code ec;
+        if (fs::is_regular_file(path, ec)) {
+            files.push_back(path);
+            continue;
+        }
+
+        auto options = fs::directory_options::skip_permission_denied;
+        for (fs::recursive_directory_iterator it(path, options, ec), end; it != end; it.increment(ec)) {
+            if (ec) {
+                break;
+            }
+            if (it->path().extension() == ".macro" && it->is_regular_file(ec)) {
+                files.push_back(it->path().string());
+            }
+        }
+        if (ec) {
+            std::cout << "Error scanning " << path << ": " << ec.message() << std::endl;
+        }
+    }
+    return files;
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--rewrite") {
+            options.rewrite = true;
+        } else if (arg == "--compact") {
+            options.encoding = Encoding::Compact;
+        } else if (arg == "--raw") {
+            options.encoding = Encoding::Raw;
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            options.jobs = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        } else if (arg.compare(0, 2, "--") == 0) {
+            return false;
+        } else {
+            options.paths.push_back(arg);
+        }
+    }
+    return !options.paths.empty();
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cout << "Usage: " << argv[0] << " [--rewrite] [--compact|--raw] [--jobs N] [--verbose] PATH..." << std::endl
+                  << "Checks .macro files for truncation, 32-bit event layouts, timestamps that go" << std::endl
+                  << "backwards and unbalanced keys. --rewrite repairs them and converts every file" << std::endl
+                  << "to the versioned format; --compact or --raw also changes the encoding." << std::endl;
+        return 2;
+    }
+    if (options.jobs == 0) {
+        options.jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::string> files = collect(options.paths);
+
+    // Files are handed out one at a time, so a few huge macros cannot leave
+    // the other workers idle.
+    Totals totals;
+    std::atomic<size_t> next(0);
+    std::mutex output_mutex;
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next++) < files.size()) {
+            // One bad file must not take the whole run down with it.
+            Report report;
+            try {
+                report = process(files[i], options);
+            } catch (const std::exception& e) {
+                report = Report();
+                report.problems.push_back(std::string("error: ") + e.what());
+            }
+            totals.files++;
+            totals.bytes += report.bytes;
+            totals.events += report.events;
+            totals.rewritten += report.rewritten ? 1 : 0;
+            if (!report.readable) {
+                totals.unreadable++;
+            } else if (report.problems.empty()) {
+                totals.clean++;
+            } else {
+                totals.with_problems++;
+                totals.unresolved += report.rewritten ? 0 : 1;
+            }
+
+            if (report.problems.empty() && report.notes.empty() && !report.rewritten && !options.verbose) {
+                continue;
+            }
+            std::ostringstream line;
+            line << files[i] << " [" << (report.format.empty() ? "unknown" : report.format) << "]";
+            const char* separator = ": ";
+            for (const auto& problem : report.problems) {
+                line << separator << problem;
+                separator = ", ";
+            }
+            for (const auto& note : report.notes) {
+                line << separator << "note: " << note;
+                separator = ", ";
+            }
+            if (report.rewritten) {
+                line << " -> rewritten";
+            }
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cout << line.str() << std::endl;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    unsigned jobs = static_cast<unsigned>(std::min<size_t>(options.jobs, std::max<size_t>(files.size(), 1)));
+    for (unsigned j = 0; j < jobs; j++) {
+        pool.emplace_back(worker);
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double megabytes = totals.bytes / (1024.0 * 1024.0);
+    char summary[256];
+    snprintf(summary, sizeof(summary),
+             "Checked %zu files (%.1f MB, %llu events) in %.2f s with %u threads: %.0f files/s, %.1f MB/s",
+             totals.files.load(), megabytes, static_cast<unsigned long long>(totals.events.load()), seconds, jobs,
+             seconds > 0 ? totals.files / seconds : 0.0, seconds > 0 ? megabytes / seconds : 0.0);
+    std::cout << summary << std::endl;
+    std::cout << "  " << totals.clean << " clean, " << totals.with_problems << " with problems, "
+              << totals.unreadable << " unreadable, " << totals.rewritten << " rewritten" << std::endl;
+
+    return totals.unreadable == 0 && totals.unresolved == 0 ? 0 : 1;
+}